@@ -0,0 +1,410 @@
+/*
+ * generates a synthetic bus network, as commands for proj2.
+ * first all the stops are added, then the lines are built link by link, and
+ * then a mix of reads and writes runs over the network, and then route
+ * queries (t) and spatial queries (n and g) over what is left of it. last come
+ * the circular lines, if any, and it ends with q.
+ *
+ * usage: generate [-s stops] [-l lines] [-L stops per line] [-H hubs]
+ *                 [-f hub fan-in] [-r reads per write] [-m mixed commands]
+ *                 [-F full listings] [-t route queries] [-k spatial queries]
+ *                 [-c circular lines] [-R laps] [-x seed] [-b 1]
+ * with -b 1, the network is built in a bulk load (between b and f).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* longitude and latitude of the center of the network */
+#define CENTER_LATITUDE 38.7223
+#define CENTER_LONGITUDE -9.1393
+/* how far (in degrees) the stops go from the center */
+#define SPREAD 0.5
+/* side of the boxes of the g queries, in degrees */
+#define BOX_SIDE 0.005
+
+typedef struct {
+    unsigned long stops;
+    unsigned long lines;
+    unsigned long line_length;
+    unsigned long hubs;
+    double fan_in;  /* chance of a link going to a hub */
+    double reads;   /* reads for each write in the mix */
+    unsigned long mixed;
+    unsigned long listings; /* of each kind (c, p, i and d with no arguments) */
+    unsigned long routes;
+    unsigned long spatial;
+    unsigned long circular; /* lines going round a ring of -L stops */
+    unsigned long laps;     /* times each circular line goes round */
+    unsigned long seed;
+    int bulk;
+} options_t;
+
+typedef struct {
+    unsigned long origin;
+    unsigned long destination;
+    int empty;
+} line_ends_t;
+
+unsigned long state;
+
+/* stops taken out by e, and how many lines have each stop as an end */
+unsigned char* removed;
+unsigned int* ends;
+line_ends_t* line_ends;
+unsigned long num_stops;
+
+/*
+ * 32 bit xorshift, the same on every platform.
+ */
+unsigned long next_random(void) {
+    state ^= (state << 13) & 0xffffffffUL;
+    state ^= state >> 17;
+    state ^= (state << 5) & 0xffffffffUL;
+    return state;
+}
+
+/*
+ * a random number in [0, n).
+ */
+unsigned long random_below(unsigned long n) {
+    return (unsigned long)((double)next_random() / 4294967296.0 * (double)n);
+}
+
+/*
+ * a random number in [0, 1).
+ */
+double random_unit(void) { return (double)next_random() / 4294967296.0; }
+
+/*
+ * prints the name of the stop: hubs have spaces in their names (so they go
+ * between quotes), every other stop doesn't.
+ */
+void print_stop(const options_t* options, unsigned long stop) {
+    if (stop < options->hubs)
+        printf("\"Hub %lu\"", stop);
+    else
+        printf("S%lu", stop);
+}
+
+/*
+ * a stop still in the network, to go next in a line.
+ */
+unsigned long pick_stop(const options_t* options) {
+    unsigned long stop;
+
+    do
+        if (options->hubs && random_unit() < options->fan_in)
+            stop = random_below(options->hubs);
+        else
+            stop = random_below(num_stops);
+    while (removed[stop]);
+    return stop;
+}
+
+void add_stop(const options_t* options, unsigned long stop) {
+    printf("p ");
+    print_stop(options, stop);
+    printf(" %.6f %.6f\n", CENTER_LATITUDE + (random_unit() - 0.5) * SPREAD,
+           CENTER_LONGITUDE + (random_unit() - 0.5) * SPREAD);
+}
+
+/*
+ * links a new stop to the end of the line (or its first two, if it is empty).
+ */
+void extend_line(const options_t* options, unsigned long line) {
+    line_ends_t* ends_of = line_ends + line;
+    unsigned long from, to;
+
+    if (ends_of->empty) {
+        from = pick_stop(options);
+        ends_of->origin = from;
+        ends[from]++;
+        ends_of->empty = 0;
+    } else {
+        from = ends_of->destination;
+        ends[from]--;
+    }
+    to = pick_stop(options);
+    ends_of->destination = to;
+    ends[to]++;
+
+    printf("l L%lu ", line);
+    print_stop(options, from);
+    putchar(' ');
+    print_stop(options, to);
+    printf(" %.2f %lu\n", random_unit() * 5, 1 + random_below(15));
+}
+
+/*
+ * a random read: mostly lookups of single lines and stops.
+ */
+void read_command(const options_t* options) {
+    unsigned long dice = random_below(10), stop;
+
+    if (dice < 4)
+        printf("c L%lu\n", random_below(options->lines));
+    else if (dice < 5)
+        printf("c L%lu inv\n", random_below(options->lines));
+    else {
+        while (removed[stop = random_below(num_stops)])
+            ;
+        printf("p ");
+        print_stop(options, stop);
+        putchar('\n');
+    }
+}
+
+/*
+ * a random write: links, new stops, and the removal of stops and lines.
+ */
+void write_command(const options_t* options) {
+    unsigned long dice = random_below(20), stop, line, tries;
+
+    if (dice < 12) {
+        extend_line(options, random_below(options->lines));
+    } else if (dice < 16) {
+        removed = realloc(removed, num_stops + 1);
+        ends = realloc(ends, sizeof(unsigned int) * (num_stops + 1));
+        if (!removed || !ends) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+        removed[num_stops] = 0;
+        ends[num_stops] = 0;
+        add_stop(options, num_stops++);
+    } else if (dice < 19) {
+        /* a stop in the middle of the lines, so their ends stay known */
+        for (tries = 0; tries < 16; tries++) {
+            stop = options->hubs + random_below(num_stops - options->hubs);
+            if (!removed[stop] && !ends[stop]) {
+                removed[stop] = 1;
+                printf("e ");
+                print_stop(options, stop);
+                putchar('\n');
+                return;
+            }
+        }
+    } else {
+        line = random_below(options->lines);
+        if (!line_ends[line].empty) {
+            ends[line_ends[line].origin]--;
+            ends[line_ends[line].destination]--;
+        }
+        line_ends[line].empty = 1;
+        printf("r L%lu\nc L%lu\n", line, line);
+    }
+}
+
+/*
+ * a route query between two stops still in the network, half of them for the
+ * quickest path.
+ */
+void route_command(const options_t* options) {
+    unsigned long origin, destination;
+
+    while (removed[origin = random_below(num_stops)])
+        ;
+    while (removed[destination = random_below(num_stops)])
+        ;
+    printf("t ");
+    print_stop(options, origin);
+    putchar(' ');
+    print_stop(options, destination);
+    printf((random_below(2)) ? " duration\n" : "\n");
+}
+
+/*
+ * a spatial query around a random point of the network: the few stops nearest
+ * to it, or the ones in a small box next to it.
+ */
+void spatial_command(void) {
+    double latitude = CENTER_LATITUDE + (random_unit() - 0.5) * SPREAD;
+    double longitude = CENTER_LONGITUDE + (random_unit() - 0.5) * SPREAD;
+
+    if (random_below(2))
+        printf("n %.6f %.6f %lu\n", latitude, longitude, 1 + random_below(10));
+    else
+        printf("g %.6f %.6f %.6f %.6f\n", latitude, longitude,
+               latitude + BOX_SIDE, longitude + BOX_SIDE);
+}
+
+/*
+ * lines going round and round a ring of stops of their own, whose stops are
+ * then removed one by one: each removal takes out a stop the line passes by
+ * once every lap.
+ */
+void circular_lines(const options_t* options) {
+    unsigned long i, j, ring = options->line_length;
+
+    for (i = 0; i < options->circular; i++) {
+        for (j = 0; j < ring; j++)
+            printf("p R%lu.%lu %.6f %.6f\n", i, j,
+                   CENTER_LATITUDE + (random_unit() - 0.5) * SPREAD,
+                   CENTER_LONGITUDE + (random_unit() - 0.5) * SPREAD);
+        printf("c C%lu\n", i);
+        for (j = 0; j < ring * options->laps; j++)
+            printf("l C%lu R%lu.%lu R%lu.%lu %.2f %lu\n", i, i, j % ring, i,
+                   (j + 1) % ring, random_unit() * 5, 1 + random_below(15));
+    }
+    for (i = 0; i < options->circular; i++)
+        for (j = 0; j < ring; j++)
+            printf("e R%lu.%lu\n", i, j);
+}
+
+/*
+ * the full listings, which grow with the whole network.
+ */
+void full_listings(const options_t* options) {
+    unsigned long i;
+    for (i = 0; i < options->listings; i++)
+        printf("c\np\ni\nd\n");
+}
+
+int parse_options(options_t* options, int argc, char** argv) {
+    int i;
+
+    options->stops = 10000;
+    options->lines = 0;
+    options->line_length = 20;
+    options->hubs = 0;
+    options->fan_in = 0.1;
+    options->reads = 4;
+    options->mixed = 0;
+    options->listings = 2;
+    options->routes = 1000;
+    options->spatial = 1000;
+    options->circular = 0;
+    options->laps = 100;
+    options->seed = 1;
+    options->bulk = 0;
+
+    for (i = 1; i + 1 < argc; i += 2) {
+        if (argv[i][0] != '-' || strlen(argv[i]) != 2)
+            return -1;
+        switch (argv[i][1]) {
+        case 's':
+            options->stops = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'l':
+            options->lines = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'L':
+            options->line_length = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'H':
+            options->hubs = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'f':
+            options->fan_in = strtod(argv[i + 1], NULL);
+            break;
+        case 'r':
+            options->reads = strtod(argv[i + 1], NULL);
+            break;
+        case 'm':
+            options->mixed = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'F':
+            options->listings = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 't':
+            options->routes = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'k':
+            options->spatial = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'c':
+            options->circular = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'R':
+            options->laps = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'x':
+            options->seed = strtoul(argv[i + 1], NULL, 10);
+            break;
+        case 'b':
+            options->bulk = atoi(argv[i + 1]);
+            break;
+        default:
+            return -1;
+        }
+    }
+    if (i != argc || options->stops < 2 || !options->line_length)
+        return -1;
+
+    /* defaults that depend on the size of the network */
+    if (!options->lines)
+        options->lines = options->stops / options->line_length + 1;
+    if (!options->hubs)
+        options->hubs = options->stops / 1000 + 1;
+    if (options->hubs >= options->stops)
+        options->hubs = options->stops - 1;
+    if (!options->mixed)
+        options->mixed = options->stops;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    options_t options;
+    unsigned long i, j, length;
+
+    if (parse_options(&options, argc, argv)) {
+        fprintf(stderr,
+                "usage: %s [-s stops] [-l lines] [-L stops per line] "
+                "[-H hubs] [-f hub fan-in] [-r reads per write] "
+                "[-m mixed commands] [-F full listings] [-t route queries] "
+                "[-k spatial queries] [-c circular lines] [-R laps] "
+                "[-x seed] [-b 1]\n",
+                argv[0]);
+        return 1;
+    }
+    state = (options.seed * 2654435761UL) & 0xffffffffUL;
+    if (!state)
+        state = 1;
+
+    num_stops = options.stops;
+    removed = calloc(num_stops, 1);
+    ends = calloc(num_stops, sizeof(unsigned int));
+    line_ends = malloc(sizeof(line_ends_t) * options.lines);
+    if (!removed || !ends || !line_ends) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    if (options.bulk)
+        printf("b\n");
+    for (i = 0; i < num_stops; i++)
+        add_stop(&options, i);
+    for (i = 0; i < options.lines; i++) {
+        printf("c L%lu\n", i);
+        line_ends[i].empty = 1;
+    }
+    for (i = 0; i < options.lines; i++) {
+        /* between half and one and a half times the mean length */
+        length = options.line_length / 2 + random_below(options.line_length);
+        for (j = 1; j < length; j++)
+            extend_line(&options, i);
+    }
+    if (options.bulk)
+        printf("f\n");
+
+    full_listings(&options);
+    for (i = 0; i < options.mixed; i++) {
+        if (random_unit() * (options.reads + 1) < options.reads)
+            read_command(&options);
+        else
+            write_command(&options);
+    }
+    full_listings(&options);
+    for (i = 0; i < options.routes; i++)
+        route_command(&options);
+    for (i = 0; i < options.spatial; i++)
+        spatial_command();
+    circular_lines(&options);
+    printf("q\n");
+
+    free(removed);
+    free(ends);
+    free(line_ends);
+    return 0;
+}
@@ -0,0 +1,49 @@
+#define _XOPEN_SOURCE 600
+#include "histogram.h"
+#include <time.h>
+
+/*
+ * monotonic time, in seconds.
+ */
+double now(void) {
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+/*
+ * adds a sample, which took the given time, to the histogram.
+ */
+void histogram_add(histogram_t* self, double seconds) {
+    double nanoseconds = seconds * 1e9, bound = 1;
+    int bucket = 0;
+
+    while (bucket < BUCKETS - 1 && nanoseconds >= bound) {
+        bound *= 1.0905077326652577; /* 2^(1/8) */
+        bucket++;
+    }
+    self->buckets[bucket]++;
+    self->count++;
+    self->total += seconds;
+}
+
+/*
+ * the latency (in seconds) below which the given fraction of the samples
+ * fall, as the top of its bucket.
+ */
+double histogram_percentile(const histogram_t* self, double fraction) {
+    unsigned long seen = 0, wanted;
+    double bound = 1;
+    int bucket;
+
+    wanted = (unsigned long)(fraction * (double)self->count);
+    if (wanted >= self->count)
+        wanted = self->count - 1;
+    for (bucket = 0; bucket < BUCKETS - 1; bucket++) {
+        seen += self->buckets[bucket];
+        if (seen > wanted)
+            break;
+        bound *= 1.0905077326652577;
+    }
+    return bound * 1e-9;
+}
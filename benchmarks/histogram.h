@@ -0,0 +1,27 @@
+#ifndef HISTOGRAM_HEADER
+#define HISTOGRAM_HEADER
+
+/*
+ * what the benchmarks share: the lookup of a stop that doesn't exist, whose
+ * answer marks the end of a command, and the histograms of the latencies.
+ */
+#define SENTINEL_NAME "__bench_sentinel__"
+#define SENTINEL_COMMAND "p " SENTINEL_NAME "\n"
+#define SENTINEL_ANSWER SENTINEL_NAME ": no such stop.\n"
+
+/* latencies from 1ns to ~68s, 8 buckets for each power of two */
+#define BUCKETS_PER_OCTAVE 8
+#define OCTAVES 36
+#define BUCKETS (BUCKETS_PER_OCTAVE * OCTAVES)
+
+typedef struct {
+    unsigned long count;
+    double total; /* in seconds */
+    unsigned long buckets[BUCKETS];
+} histogram_t;
+
+double now(void);
+void histogram_add(histogram_t* self, double seconds);
+double histogram_percentile(const histogram_t* self, double fraction);
+
+#endif /* !HISTOGRAM_HEADER */
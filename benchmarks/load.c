@@ -0,0 +1,372 @@
+/*
+ * runs proj2 as a server (-S) and loads it with many clients at once.
+ * the workload is split at its first full listing (a lone c, as generate
+ * writes them once the network is built): what comes before it builds the
+ * network, sent by a single client, and what comes after it (up to q) is then
+ * sent by every client at the same time.
+ * each client keeps up to depth commands in flight, each one followed by a
+ * lookup of a stop that doesn't exist, whose answer marks the end of it (as in
+ * run.c, but without taking the lookup out of the times).
+ *
+ * usage: load proj2 workload [clients] [depth]
+ */
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "histogram.h"
+
+#define MAX_CLIENTS 1024
+/* commands the single client building the network keeps in flight */
+#define BUILD_DEPTH 4096
+
+typedef struct {
+    int fd;
+    unsigned long next;     /* command to send next */
+    unsigned long answered; /* commands whose output was all read */
+    double* sent_at;        /* of the commands in flight, by number % depth */
+    char* pending;          /* bytes to send */
+    size_t pending_size;
+    size_t pending_sent;
+    size_t pending_capacity;
+    long matched; /* bytes of the output line like the sentinel's answer */
+} client_t;
+
+/* the workload, and where each command in it starts */
+char* workload;
+size_t* commands;
+unsigned long num_commands;
+
+histogram_t histograms[128];
+histogram_t all;
+
+/*
+ * reads the whole workload and finds where its commands start.
+ * returns 0 if ok, -1 otherwise.
+ */
+int read_workload(const char* path) {
+    struct stat info;
+    unsigned long capacity = 1024;
+    size_t i;
+    FILE* file;
+
+    if (!(file = fopen(path, "r")) || fstat(fileno(file), &info) ||
+        !(workload = malloc((size_t)info.st_size + 1)) ||
+        fread(workload, 1, (size_t)info.st_size, file) !=
+            (size_t)info.st_size) {
+        perror(path);
+        return -1;
+    }
+    fclose(file);
+    workload[info.st_size] = '\n';
+
+    if (!(commands = malloc(sizeof(size_t) * capacity)))
+        return -1;
+    /* each command ends with its newline, where the next one starts */
+    for (i = 0; i < (size_t)info.st_size; i++) {
+        if (num_commands + 1 == capacity &&
+            !(commands = realloc(commands, sizeof(size_t) * (capacity *= 2))))
+            return -1;
+        commands[num_commands++] = i;
+        while (workload[i] != '\n')
+            i++;
+    }
+    commands[num_commands] = i;
+    return 0;
+}
+
+/*
+ * starts proj2 serving the socket, and waits until it can be connected to.
+ * returns its pid, or -1 if it didn't start.
+ */
+pid_t server_start(const char* program, const char* path) {
+    struct stat info;
+    pid_t pid;
+    int tries;
+
+    if ((pid = fork()) < 0)
+        return -1;
+    if (!pid) {
+        dup2(open("/dev/null", O_WRONLY), 1);
+        execl(program, program, "-S", path, (char*)NULL);
+        perror(program);
+        _exit(127);
+    }
+    for (tries = 0; tries < 1000; tries++) {
+        if (!stat(path, &info) && S_ISSOCK(info.st_mode))
+            return pid;
+        usleep(10000);
+    }
+    kill(pid, SIGKILL);
+    return -1;
+}
+
+/*
+ * connects a client to the socket.
+ * returns 0 if ok, -1 otherwise.
+ */
+int client_connect(client_t* self, const char* path, unsigned long depth) {
+    struct sockaddr_un address;
+
+    memset(self, 0, sizeof(client_t));
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if ((self->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        connect(self->fd, (struct sockaddr*)&address, sizeof(address)) ||
+        fcntl(self->fd, F_SETFL, O_NONBLOCK) ||
+        !(self->sent_at = malloc(sizeof(double) * depth)))
+        return -1;
+    return 0;
+}
+
+void client_close(client_t* self) {
+    close(self->fd);
+    free(self->sent_at);
+    free(self->pending);
+}
+
+/*
+ * puts the next command (and the sentinel after it) in the bytes to send.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int client_queue(client_t* self, unsigned long command, unsigned long depth) {
+    size_t size = commands[command + 1] - commands[command], needed;
+    char* pending;
+
+    if (self->pending_sent) {
+        self->pending_size -= self->pending_sent;
+        memmove(self->pending, self->pending + self->pending_sent,
+                self->pending_size);
+        self->pending_sent = 0;
+    }
+    needed = self->pending_size + size + sizeof(SENTINEL_COMMAND);
+
+    if (needed > self->pending_capacity) {
+        if (!(pending = realloc(self->pending, needed * 2)))
+            return -1;
+        self->pending = pending;
+        self->pending_capacity = needed * 2;
+    }
+    memcpy(self->pending + self->pending_size, workload + commands[command],
+           size);
+    self->pending_size += size;
+    memcpy(self->pending + self->pending_size, SENTINEL_COMMAND,
+           sizeof(SENTINEL_COMMAND) - 1);
+    self->pending_size += sizeof(SENTINEL_COMMAND) - 1;
+    self->sent_at[command % depth] = now();
+    return 0;
+}
+
+/*
+ * looks for the sentinel's answers in the output, a whole line at a time.
+ * returns how many there were.
+ */
+unsigned long client_answers(client_t* self, const char* bytes, size_t size) {
+    unsigned long found = 0;
+    size_t i;
+
+    for (i = 0; i < size; i++) {
+        if (self->matched >= 0 &&
+            (size_t)self->matched < sizeof(SENTINEL_ANSWER) - 1 &&
+            SENTINEL_ANSWER[self->matched] == bytes[i])
+            self->matched++;
+        else
+            self->matched = -1;
+        if (bytes[i] == '\n') {
+            if (self->matched == sizeof(SENTINEL_ANSWER) - 1)
+                found++;
+            self->matched = 0;
+        }
+    }
+    return found;
+}
+
+/*
+ * sends the commands first to last (each client all of them) keeping up to
+ * depth of them in flight, and times each one if record is set.
+ * returns 0 if ok, -1 if the server went away.
+ */
+int run_clients(client_t* clients, int num_clients, unsigned long first,
+                unsigned long last, unsigned long depth, int record) {
+    static struct pollfd fds[MAX_CLIENTS];
+    char output[65536];
+    unsigned long answers, command;
+    int i, done = 0;
+    ssize_t count;
+    client_t* client;
+    double elapsed;
+
+    for (i = 0; i < num_clients; i++)
+        clients[i].next = clients[i].answered = first;
+    while (done < num_clients) {
+        for (i = 0; i < num_clients; i++) {
+            client = clients + i;
+            while (client->next < last &&
+                   client->next - client->answered < depth)
+                if (client_queue(client, client->next++, depth))
+                    return -1;
+            fds[i].fd = (client->answered < last) ? client->fd : -1;
+            fds[i].events = POLLIN;
+            if (client->pending_sent < client->pending_size)
+                fds[i].events |= POLLOUT;
+        }
+        if (poll(fds, num_clients, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        for (i = 0; i < num_clients; i++) {
+            client = clients + i;
+            if (fds[i].revents & POLLOUT) {
+                count = write(client->fd,
+                              client->pending + client->pending_sent,
+                              client->pending_size - client->pending_sent);
+                if (count < 0 && errno != EAGAIN)
+                    return -1;
+                if (count > 0)
+                    client->pending_sent += (size_t)count;
+            }
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                continue;
+            if ((count = read(client->fd, output, sizeof(output))) <= 0) {
+                if (count < 0 && errno == EAGAIN)
+                    continue;
+                return -1;
+            }
+            answers = client_answers(client, output, (size_t)count);
+            for (; answers; answers--) {
+                command = client->answered++;
+                if (record) {
+                    elapsed = now() - client->sent_at[command % depth];
+                    histogram_add(histograms +
+                                      (workload[commands[command]] & 0x7f),
+                                  elapsed);
+                    histogram_add(&all, elapsed);
+                }
+            }
+            if (client->answered == last)
+                done++;
+        }
+    }
+    return 0;
+}
+
+/*
+ * the first full listing (a lone c), where the network is built.
+ */
+unsigned long find_split(void) {
+    unsigned long i;
+    for (i = 0; i < num_commands; i++)
+        if (workload[commands[i]] == 'c' && workload[commands[i] + 1] == '\n')
+            return i;
+    return num_commands;
+}
+
+/*
+ * the commands sent by every client end before the q.
+ */
+unsigned long find_end(unsigned long split) {
+    unsigned long i;
+    for (i = split; i < num_commands; i++)
+        if (workload[commands[i]] == 'q')
+            return i;
+    return num_commands;
+}
+
+int main(int argc, char** argv) {
+    static client_t clients[MAX_CLIENTS];
+    char path[64];
+    unsigned long split, end, depth = 16;
+    int num_clients = 8, i, status;
+    double start, elapsed;
+    pid_t pid;
+
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr, "usage: %s proj2 workload [clients] [depth]\n",
+                argv[0]);
+        return 1;
+    }
+    if (argc > 3)
+        num_clients = atoi(argv[3]);
+    if (argc > 4)
+        depth = strtoul(argv[4], NULL, 10);
+    if (num_clients < 1 || num_clients > MAX_CLIENTS || !depth) {
+        fprintf(stderr, "1 to %d clients, and a depth of 1 or more\n",
+                MAX_CLIENTS);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (read_workload(argv[2]))
+        return 1;
+    split = find_split();
+    end = find_end(split);
+
+    sprintf(path, "/tmp/proj2-load-%ld.sock", (long)getpid());
+    if ((pid = server_start(argv[1], path)) < 0) {
+        fprintf(stderr, "proj2 didn't start serving %s\n", path);
+        return 1;
+    }
+
+    start = now();
+    if (client_connect(clients, path, BUILD_DEPTH) ||
+        run_clients(clients, 1, 0, split, BUILD_DEPTH, 0)) {
+        fprintf(stderr, "proj2 went away while building the network\n");
+        kill(pid, SIGKILL);
+        return 1;
+    }
+    client_close(clients);
+    printf("network built by one client: %lu commands in %.3f s\n", split,
+           now() - start);
+
+    for (i = 0; i < num_clients; i++)
+        if (client_connect(clients + i, path, depth)) {
+            perror(path);
+            kill(pid, SIGKILL);
+            return 1;
+        }
+    start = now();
+    if (run_clients(clients, num_clients, split, end, depth, 1)) {
+        fprintf(stderr, "proj2 went away\n");
+        kill(pid, SIGKILL);
+        return 1;
+    }
+    elapsed = now() - start;
+    for (i = 0; i < num_clients; i++)
+        client_close(clients + i);
+
+    kill(pid, SIGTERM);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+        WEXITSTATUS(status)) {
+        fprintf(stderr, "proj2 didn't end well\n");
+        return 1;
+    }
+
+    printf("%d clients, %lu in flight each: %lu commands in %.3f s, "
+           "%.0f commands/s\n",
+           num_clients, depth, all.count, elapsed,
+           (double)all.count / elapsed);
+    printf("%-8s %10s %10s %10s\n", "command", "count", "p50 us", "p99 us");
+    for (i = 0; i < 128; i++) {
+        if (!histograms[i].count)
+            continue;
+        printf("%-8c %10lu %10.2f %10.2f\n", i, histograms[i].count,
+               histogram_percentile(histograms + i, 0.5) * 1e6,
+               histogram_percentile(histograms + i, 0.99) * 1e6);
+    }
+    printf("%-8s %10lu %10.2f %10.2f\n", "all", all.count,
+           histogram_percentile(&all, 0.5) * 1e6,
+           histogram_percentile(&all, 0.99) * 1e6);
+    return 0;
+}
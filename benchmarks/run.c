@@ -0,0 +1,271 @@
+/*
+ * runs proj2 over a workload and reports how it went.
+ * the workload is first run as a whole (for the wall time and peak memory),
+ * and then a command at a time, each followed by a lookup of a stop that
+ * doesn't exist: proj2 flushes its output before waiting for more input, so
+ * the answer to that lookup marks the end of the command. the time of a
+ * lookup alone is measured up front and taken out of every command.
+ *
+ * usage: run proj2 workload
+ */
+#define _XOPEN_SOURCE 600
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "histogram.h"
+
+/* longest command in the workload (the spec allows 65535 bytes) */
+#define MAX_COMMAND 65536
+/* lone lookups timed to find the cost of the sentinel */
+#define SENTINEL_SAMPLES 2000
+
+typedef struct {
+    pid_t pid;
+    int to;   /* proj2's stdin */
+    int from; /* proj2's stdout */
+    /* the last bytes read, to find the sentinel's answer */
+    char tail[sizeof(SENTINEL_ANSWER)];
+    size_t tail_size;
+} child_t;
+
+histogram_t histograms[128];
+histogram_t sentinel;
+
+/*
+ * starts proj2 with the given stdin (or a pipe, if it is -1).
+ * its stdout goes to a pipe, or to /dev/null if discard is set.
+ */
+int child_start(child_t* self, const char* program, int in, int discard) {
+    int to[2] = {-1, -1}, from[2] = {-1, -1};
+
+    if ((in < 0 && pipe(to)) || (!discard && pipe(from)))
+        return -1;
+    if ((self->pid = fork()) < 0)
+        return -1;
+
+    if (!self->pid) {
+        dup2((in < 0) ? to[0] : in, 0);
+        if (discard)
+            dup2(open("/dev/null", O_WRONLY), 1);
+        else
+            dup2(from[1], 1);
+        if (in < 0) {
+            close(to[0]);
+            close(to[1]);
+        }
+        if (!discard) {
+            close(from[0]);
+            close(from[1]);
+        }
+        execl(program, program, (char*)NULL);
+        perror(program);
+        _exit(127);
+    }
+
+    if (in < 0)
+        close(to[0]);
+    if (!discard)
+        close(from[1]);
+    self->to = to[1];
+    self->from = from[0];
+    self->tail_size = 0;
+    return 0;
+}
+
+/*
+ * waits for proj2 to end.
+ * returns its peak memory (in KiB), or -1 if it didn't end well.
+ */
+long child_wait(child_t* self) {
+    struct rusage usage;
+    int status;
+
+    if (self->to >= 0)
+        close(self->to);
+    if (self->from >= 0)
+        close(self->from);
+    while (waitpid(self->pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        return -1;
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return usage.ru_maxrss;
+}
+
+/*
+ * keeps the last bytes read, and whether they are the sentinel's answer.
+ */
+int child_saw_sentinel(child_t* self, const char* bytes, size_t size) {
+    size_t keep = sizeof(self->tail) - 1, moved;
+
+    if (size >= keep) {
+        memcpy(self->tail, bytes + size - keep, keep);
+        self->tail_size = keep;
+    } else {
+        moved = (self->tail_size + size > keep) ? keep - size : self->tail_size;
+        memmove(self->tail, self->tail + self->tail_size - moved, moved);
+        memcpy(self->tail + moved, bytes, size);
+        self->tail_size = moved + size;
+    }
+    return self->tail_size == keep &&
+           !memcmp(self->tail, SENTINEL_ANSWER, keep);
+}
+
+/*
+ * sends the command (followed by the sentinel) and reads the output until the
+ * sentinel's answer, reading while writing so neither side blocks.
+ * returns the time it took, or -1 if proj2 went away.
+ */
+double child_command(child_t* self, const char* command, size_t size) {
+    static char buffer[MAX_COMMAND + sizeof(SENTINEL_COMMAND)];
+    char output[65536];
+    struct pollfd fds[2];
+    size_t written = 0;
+    ssize_t count;
+    double start;
+
+    memcpy(buffer, command, size);
+    memcpy(buffer + size, SENTINEL_COMMAND, sizeof(SENTINEL_COMMAND) - 1);
+    size += sizeof(SENTINEL_COMMAND) - 1;
+
+    start = now();
+    for (;;) {
+        fds[0].fd = self->from;
+        fds[0].events = POLLIN;
+        fds[1].fd = (written < size) ? self->to : -1;
+        fds[1].events = POLLOUT;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (fds[1].revents & (POLLOUT | POLLERR)) {
+            if ((count = write(self->to, buffer + written, size - written)) < 0)
+                return -1;
+            written += (size_t)count;
+        }
+        if (fds[0].revents & (POLLIN | POLLHUP)) {
+            if ((count = read(self->from, output, sizeof(output))) <= 0)
+                return -1;
+            if (child_saw_sentinel(self, output, (size_t)count))
+                return now() - start;
+        }
+    }
+}
+
+/*
+ * runs the whole workload at once.
+ */
+int run_whole(const char* program, const char* workload) {
+    child_t child;
+    double start, elapsed;
+    long peak;
+    int in;
+
+    if ((in = open(workload, O_RDONLY)) < 0) {
+        perror(workload);
+        return -1;
+    }
+    start = now();
+    if (child_start(&child, program, in, 1)) {
+        perror("proj2");
+        return -1;
+    }
+    close(in);
+    child.to = child.from = -1;
+    peak = child_wait(&child);
+    elapsed = now() - start;
+    if (peak < 0) {
+        fprintf(stderr, "proj2 failed on the whole workload\n");
+        return -1;
+    }
+    printf("whole workload: %.3f s, peak RSS %.1f MiB\n", elapsed,
+           (double)peak / 1024);
+    return 0;
+}
+
+/*
+ * runs the workload a command at a time, timing each one.
+ */
+int run_commands(const char* program, const char* workload) {
+    static char command[MAX_COMMAND + 2];
+    child_t child;
+    FILE* file;
+    double elapsed, overhead;
+    size_t size;
+    int i;
+
+    if (!(file = fopen(workload, "r"))) {
+        perror(workload);
+        return -1;
+    }
+    if (child_start(&child, program, -1, 0)) {
+        perror("proj2");
+        return -1;
+    }
+
+    for (i = 0; i < SENTINEL_SAMPLES; i++) {
+        if ((elapsed = child_command(&child, "", 0)) < 0)
+            break;
+        histogram_add(&sentinel, elapsed);
+    }
+    overhead = histogram_percentile(&sentinel, 0.5);
+
+    while (fgets(command, sizeof(command), file)) {
+        size = strlen(command);
+        /* q ends proj2, so there would be no answer to the sentinel */
+        if (command[0] == 'q')
+            break;
+        if ((elapsed = child_command(&child, command, size)) < 0) {
+            fprintf(stderr, "proj2 went away\n");
+            fclose(file);
+            return -1;
+        }
+        elapsed -= overhead;
+        histogram_add(histograms + (command[0] & 0x7f),
+                      (elapsed > 0) ? elapsed : 0);
+    }
+    fclose(file);
+    if (write(child.to, "q\n", 2) != 2 || child_wait(&child) < 0) {
+        fprintf(stderr, "proj2 failed on the workload\n");
+        return -1;
+    }
+
+    printf("round trip of a lookup: %.2f us (taken out below)\n",
+           overhead * 1e6);
+    printf("%-8s %10s %10s %12s %10s %10s\n", "command", "count", "total s",
+           "ops/s", "p50 us", "p99 us");
+    for (i = 0; i < 128; i++) {
+        if (!histograms[i].count)
+            continue;
+        printf("%-8c %10lu %10.3f %12.0f %10.2f %10.2f\n", i,
+               histograms[i].count, histograms[i].total,
+               (histograms[i].total > 0)
+                   ? (double)histograms[i].count / histograms[i].total
+                   : 0.0,
+               histogram_percentile(histograms + i, 0.5) * 1e6,
+               histogram_percentile(histograms + i, 0.99) * 1e6);
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s proj2 workload\n", argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (run_whole(argv[1], argv[2]) || run_commands(argv[1], argv[2]))
+        return 1;
+    return 0;
+}
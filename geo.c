@@ -0,0 +1,445 @@
+#include "geo.h"
+
+#if defined(__GNUC__) && defined(__SSE2__)
+#define GEO_SSE2
+#include <emmintrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define GEO_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+#define GEO_PI 3.14159265358979323846
+#define GEO_HALF_PI (GEO_PI / 2)
+#define GEO_TWO_PI (GEO_PI * 2)
+#define GEO_RADIANS (GEO_PI / 180)
+#define GEO_HALF_RADIANS (GEO_PI / 360)
+/* added and taken back, rounds a double (smaller than 2^51) to an integer */
+#define GEO_ROUND 6755399441055744.0
+/* an ulp of the doubles in [1/2, 1) */
+#define GEO_ULP (1.0 / 9007199254740992.0)
+/* 2^27 + 1, splits a double in halves whose products are exact */
+#define GEO_SPLIT 134217729.0
+
+/*
+ * taylor series of the sine, from x^3 (good to the last bit within pi / 2).
+ * the arcsine on [0, 1/2] is fdlibm's rational approximation.
+ */
+#define GEO_SINE_TERMS 10
+#define GEO_ASIN_P_TERMS 6
+#define GEO_ASIN_Q_TERMS 5
+const double geo_sine[GEO_SINE_TERMS] = {
+    -1.0 / 6.0,
+    1.0 / 120.0,
+    -1.0 / 5040.0,
+    1.0 / 362880.0,
+    -1.0 / 39916800.0,
+    1.0 / 6227020800.0,
+    -1.0 / 1307674368000.0,
+    1.0 / 355687428096000.0,
+    -1.0 / 121645100408832000.0,
+    1.0 / 51090942171709440000.0};
+const double geo_asin_p[GEO_ASIN_P_TERMS] = {
+    1.66666666666666657415e-01, -3.25565818622400915405e-01,
+    2.01212532134862925881e-01, -4.00555345006794114027e-02,
+    7.91534994289814532176e-04, 3.47933107596021167570e-05};
+const double geo_asin_q[GEO_ASIN_Q_TERMS] = {
+    1.0, -2.40339491173441421878e+00, 2.02094576023350569471e+00,
+    -6.88283971605453293030e-01, 7.70381505559019352791e-02};
+
+typedef void (*geo_kernel_t)(const double*, const double*, double*,
+                             unsigned int);
+
+/* the widest kernel the processor runs, picked on the first call */
+geo_kernel_t geo_kernel;
+
+/*
+ * the vector kernels below do these same operations, in the same order, on
+ * each lane, and the square root is rounded as the instruction they use
+ * rounds it: whichever one runs, the legs come out the same (as long as
+ * doubles are computed as doubles, which the x87 doesn't do).
+ */
+
+/*
+ * the sign of a * b - x, where a * b is within a factor of 2 of x.
+ * the product is split into its rounded value and the error of that rounding
+ * (dekker's), and the rounded value less x is exact (sterbenz's lemma).
+ */
+__always_inline double geo_product_less(double a, double b, double x) {
+    double product = a * b, split, a_high, a_low, b_high, b_low, error;
+
+    split = GEO_SPLIT * a;
+    a_high = split - (split - a);
+    a_low = a - a_high;
+    split = GEO_SPLIT * b;
+    b_high = split - (split - b);
+    b_low = b - b_high;
+    error = ((a_high * b_high - product) + a_high * b_low + a_low * b_high) +
+            a_low * b_low;
+    return (product - x) + error;
+}
+
+/*
+ * the square root, correctly rounded (as the vector kernels' instruction
+ * gives it): newton's method from above gets within an ulp or so, and then
+ * the root r is moved to its neighbours until r (r - ulp) < x <= r (r + ulp),
+ * which is what being the nearest double to the root comes down to.
+ */
+__always_inline double geo_sqrt(double x) {
+    double root = 1, next, scale = 1, up, down;
+
+    if (!(x > 0))
+        return x;
+    while (x < 1.0 / 1048576) {
+        x *= 1048576;
+        scale /= 1024;
+    }
+    while (x > 1) {
+        x /= 4;
+        scale *= 2;
+    }
+    while (x < 0.25) {
+        x *= 4;
+        scale /= 2;
+    }
+    for (;;) {
+        next = 0.5 * (root + x / root);
+        if (next >= root)
+            break;
+        root = next;
+    }
+    /* the root is in [1/2, 1], where an ulp is 2^-53 (below 1) */
+    for (;;) {
+        up = root + ((root < 1) ? GEO_ULP : 2 * GEO_ULP);
+        down = root - ((root > 0.5) ? GEO_ULP : GEO_ULP / 2);
+        if (geo_product_less(root, up, x) < 0)
+            root = up;
+        else if (geo_product_less(root, down, x) >= 0)
+            root = down;
+        else
+            break;
+    }
+    return root * scale;
+}
+
+/*
+ * x less the multiple of period nearest to it.
+ */
+__always_inline double geo_reduce(double x, double period) {
+    double multiple = (x * (1 / period) + GEO_ROUND) - GEO_ROUND;
+    return x - multiple * period;
+}
+
+/*
+ * the sine of x, within pi / 2 of 0.
+ */
+__always_inline double geo_sin(double x) {
+    double z = x * x, sum = geo_sine[GEO_SINE_TERMS - 1];
+    int i;
+
+    for (i = GEO_SINE_TERMS - 2; i >= 0; i--)
+        sum = geo_sine[i] + z * sum;
+    return x + x * z * sum;
+}
+
+/*
+ * the cosine of any x.
+ */
+__always_inline double geo_cos(double x) {
+    x = geo_reduce(x, GEO_TWO_PI);
+    return geo_sin(GEO_HALF_PI - ((x < 0) ? -x : x));
+}
+
+/*
+ * the arcsine of x, in [0, 1/2].
+ */
+__always_inline double geo_asin(double x) {
+    double z = x * x, p = geo_asin_p[GEO_ASIN_P_TERMS - 1],
+           q = geo_asin_q[GEO_ASIN_Q_TERMS - 1];
+    int i;
+
+    for (i = GEO_ASIN_P_TERMS - 2; i >= 0; i--)
+        p = geo_asin_p[i] + z * p;
+    for (i = GEO_ASIN_Q_TERMS - 2; i >= 0; i--)
+        q = geo_asin_q[i] + z * q;
+    return x + x * (z * p / q);
+}
+
+/*
+ * the length of a leg: the haversine of the angle between its ends is
+ * sin²(dlat / 2) + cos(lat1) cos(lat2) sin²(dlon / 2), and the angle is twice
+ * the arcsine of its root (for roots over 1/2, by asin(s) = pi / 2 -
+ * 2 asin(sqrt((1 - s) / 2)), where the approximation holds).
+ */
+double geo_leg(double from_latitude, double from_longitude, double to_latitude,
+               double to_longitude) {
+    double latitude = geo_sin(
+        geo_reduce((to_latitude - from_latitude) * GEO_HALF_RADIANS, GEO_PI));
+    double longitude = geo_sin(geo_reduce(
+        (to_longitude - from_longitude) * GEO_HALF_RADIANS, GEO_PI));
+    double haversine, root, angle;
+
+    haversine = latitude * latitude + geo_cos(from_latitude * GEO_RADIANS) *
+                                          geo_cos(to_latitude * GEO_RADIANS) *
+                                          (longitude * longitude);
+    haversine = (haversine < 0) ? 0 : (haversine > 1) ? 1 : haversine;
+    root = geo_sqrt(haversine);
+    angle = (root <= 0.5) ? 2 * geo_asin(root)
+                          : GEO_PI - 4 * geo_asin(geo_sqrt((1 - root) * 0.5));
+    return angle * GEO_EARTH_RADIUS;
+}
+
+/*
+ * one leg at a time.
+ */
+void geo_legs_scalar(const double* latitudes, const double* longitudes,
+                     double* legs, unsigned int count) {
+    unsigned int i;
+    for (i = 0; i + 1 < count; i++)
+        legs[i] = geo_leg(latitudes[i], longitudes[i], latitudes[i + 1],
+                          longitudes[i + 1]);
+}
+
+#ifdef GEO_SSE2
+/* legs in a sse2 vector */
+#define GEO_SSE2_LANES 2
+
+__always_inline __m128d geo_reduce_sse2(__m128d x, double period) {
+    __m128d round = _mm_set1_pd(GEO_ROUND);
+    __m128d multiple = _mm_sub_pd(
+        _mm_add_pd(_mm_mul_pd(x, _mm_set1_pd(1 / period)), round), round);
+    return _mm_sub_pd(x, _mm_mul_pd(multiple, _mm_set1_pd(period)));
+}
+
+__always_inline __m128d geo_sin_sse2(__m128d x) {
+    __m128d z = _mm_mul_pd(x, x);
+    __m128d sum = _mm_set1_pd(geo_sine[GEO_SINE_TERMS - 1]);
+    int i;
+
+    for (i = GEO_SINE_TERMS - 2; i >= 0; i--)
+        sum = _mm_add_pd(_mm_set1_pd(geo_sine[i]), _mm_mul_pd(z, sum));
+    return _mm_add_pd(x, _mm_mul_pd(_mm_mul_pd(x, z), sum));
+}
+
+__always_inline __m128d geo_cos_sse2(__m128d x) {
+    x = geo_reduce_sse2(x, GEO_TWO_PI);
+    x = _mm_andnot_pd(_mm_set1_pd(-0.0), x);
+    return geo_sin_sse2(_mm_sub_pd(_mm_set1_pd(GEO_HALF_PI), x));
+}
+
+__always_inline __m128d geo_asin_sse2(__m128d x) {
+    __m128d z = _mm_mul_pd(x, x);
+    __m128d p = _mm_set1_pd(geo_asin_p[GEO_ASIN_P_TERMS - 1]);
+    __m128d q = _mm_set1_pd(geo_asin_q[GEO_ASIN_Q_TERMS - 1]);
+    int i;
+
+    for (i = GEO_ASIN_P_TERMS - 2; i >= 0; i--)
+        p = _mm_add_pd(_mm_set1_pd(geo_asin_p[i]), _mm_mul_pd(z, p));
+    for (i = GEO_ASIN_Q_TERMS - 2; i >= 0; i--)
+        q = _mm_add_pd(_mm_set1_pd(geo_asin_q[i]), _mm_mul_pd(z, q));
+    return _mm_add_pd(x, _mm_mul_pd(x, _mm_div_pd(_mm_mul_pd(z, p), q)));
+}
+
+/*
+ * geo_leg(), for the legs starting at the given points.
+ */
+__always_inline __m128d geo_leg_sse2(const double* latitudes,
+                                     const double* longitudes) {
+    __m128d from_latitude = _mm_loadu_pd(latitudes);
+    __m128d to_latitude = _mm_loadu_pd(latitudes + 1);
+    __m128d half_radians = _mm_set1_pd(GEO_HALF_RADIANS);
+    __m128d radians = _mm_set1_pd(GEO_RADIANS);
+    __m128d latitude, longitude, haversine, root, angle, mask;
+
+    latitude = geo_sin_sse2(geo_reduce_sse2(
+        _mm_mul_pd(_mm_sub_pd(to_latitude, from_latitude), half_radians),
+        GEO_PI));
+    longitude = geo_sin_sse2(geo_reduce_sse2(
+        _mm_mul_pd(_mm_sub_pd(_mm_loadu_pd(longitudes + 1),
+                              _mm_loadu_pd(longitudes)),
+                   half_radians),
+        GEO_PI));
+    haversine = _mm_add_pd(
+        _mm_mul_pd(latitude, latitude),
+        _mm_mul_pd(_mm_mul_pd(geo_cos_sse2(_mm_mul_pd(from_latitude, radians)),
+                              geo_cos_sse2(_mm_mul_pd(to_latitude, radians))),
+                   _mm_mul_pd(longitude, longitude)));
+    haversine = _mm_min_pd(_mm_set1_pd(1),
+                           _mm_max_pd(_mm_setzero_pd(), haversine));
+    root = _mm_sqrt_pd(haversine);
+    angle = _mm_mul_pd(_mm_set1_pd(2), geo_asin_sse2(root));
+    mask = _mm_cmple_pd(root, _mm_set1_pd(0.5));
+    /* legs over a third of the way around the earth are rare */
+    if (_mm_movemask_pd(mask) != 0x3)
+        angle = _mm_or_pd(
+            _mm_and_pd(mask, angle),
+            _mm_andnot_pd(
+                mask,
+                _mm_sub_pd(_mm_set1_pd(GEO_PI),
+                           _mm_mul_pd(_mm_set1_pd(4),
+                                      geo_asin_sse2(_mm_sqrt_pd(_mm_mul_pd(
+                                          _mm_sub_pd(_mm_set1_pd(1), root),
+                                          _mm_set1_pd(0.5))))))));
+    return _mm_mul_pd(angle, _mm_set1_pd(GEO_EARTH_RADIUS));
+}
+
+/*
+ * two legs at a time. the last ones are done from a copy of their points,
+ * padded to a whole vector.
+ */
+void geo_legs_sse2(const double* latitudes, const double* longitudes,
+                   double* legs, unsigned int count) {
+    double tail_latitudes[GEO_SSE2_LANES + 1];
+    double tail_longitudes[GEO_SSE2_LANES + 1];
+    double tail_legs[GEO_SSE2_LANES];
+    unsigned int i, j;
+
+    for (i = 0; i + GEO_SSE2_LANES < count; i += GEO_SSE2_LANES)
+        _mm_storeu_pd(legs + i, geo_leg_sse2(latitudes + i, longitudes + i));
+    if (i + 1 >= count)
+        return;
+    for (j = 0; j <= GEO_SSE2_LANES; j++) {
+        tail_latitudes[j] = latitudes[(i + j < count) ? i + j : count - 1];
+        tail_longitudes[j] = longitudes[(i + j < count) ? i + j : count - 1];
+    }
+    _mm_storeu_pd(tail_legs, geo_leg_sse2(tail_latitudes, tail_longitudes));
+    for (j = 0; i + j + 1 < count; j++)
+        legs[i + j] = tail_legs[j];
+}
+#endif /* GEO_SSE2 */
+
+#ifdef GEO_AVX2
+/* legs in an avx2 vector */
+#define GEO_AVX2_LANES 4
+#define GEO_AVX2_TARGET __attribute__((target("avx2")))
+
+GEO_AVX2_TARGET __always_inline __m256d geo_reduce_avx2(__m256d x,
+                                                         double period) {
+    __m256d round = _mm256_set1_pd(GEO_ROUND);
+    __m256d multiple = _mm256_sub_pd(
+        _mm256_add_pd(_mm256_mul_pd(x, _mm256_set1_pd(1 / period)), round),
+        round);
+    return _mm256_sub_pd(x, _mm256_mul_pd(multiple, _mm256_set1_pd(period)));
+}
+
+GEO_AVX2_TARGET __always_inline __m256d geo_sin_avx2(__m256d x) {
+    __m256d z = _mm256_mul_pd(x, x);
+    __m256d sum = _mm256_set1_pd(geo_sine[GEO_SINE_TERMS - 1]);
+    int i;
+
+    for (i = GEO_SINE_TERMS - 2; i >= 0; i--)
+        sum = _mm256_add_pd(_mm256_set1_pd(geo_sine[i]), _mm256_mul_pd(z, sum));
+    return _mm256_add_pd(x, _mm256_mul_pd(_mm256_mul_pd(x, z), sum));
+}
+
+GEO_AVX2_TARGET __always_inline __m256d geo_cos_avx2(__m256d x) {
+    x = geo_reduce_avx2(x, GEO_TWO_PI);
+    x = _mm256_andnot_pd(_mm256_set1_pd(-0.0), x);
+    return geo_sin_avx2(_mm256_sub_pd(_mm256_set1_pd(GEO_HALF_PI), x));
+}
+
+GEO_AVX2_TARGET __always_inline __m256d geo_asin_avx2(__m256d x) {
+    __m256d z = _mm256_mul_pd(x, x);
+    __m256d p = _mm256_set1_pd(geo_asin_p[GEO_ASIN_P_TERMS - 1]);
+    __m256d q = _mm256_set1_pd(geo_asin_q[GEO_ASIN_Q_TERMS - 1]);
+    int i;
+
+    for (i = GEO_ASIN_P_TERMS - 2; i >= 0; i--)
+        p = _mm256_add_pd(_mm256_set1_pd(geo_asin_p[i]), _mm256_mul_pd(z, p));
+    for (i = GEO_ASIN_Q_TERMS - 2; i >= 0; i--)
+        q = _mm256_add_pd(_mm256_set1_pd(geo_asin_q[i]), _mm256_mul_pd(z, q));
+    return _mm256_add_pd(
+        x, _mm256_mul_pd(x, _mm256_div_pd(_mm256_mul_pd(z, p), q)));
+}
+
+/*
+ * geo_leg(), for the legs starting at the given points.
+ */
+GEO_AVX2_TARGET __always_inline __m256d
+geo_leg_avx2(const double* latitudes, const double* longitudes) {
+    __m256d from_latitude = _mm256_loadu_pd(latitudes);
+    __m256d to_latitude = _mm256_loadu_pd(latitudes + 1);
+    __m256d half_radians = _mm256_set1_pd(GEO_HALF_RADIANS);
+    __m256d radians = _mm256_set1_pd(GEO_RADIANS);
+    __m256d latitude, longitude, haversine, root, angle, mask;
+
+    latitude = geo_sin_avx2(geo_reduce_avx2(
+        _mm256_mul_pd(_mm256_sub_pd(to_latitude, from_latitude), half_radians),
+        GEO_PI));
+    longitude = geo_sin_avx2(geo_reduce_avx2(
+        _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(longitudes + 1),
+                                    _mm256_loadu_pd(longitudes)),
+                      half_radians),
+        GEO_PI));
+    haversine = _mm256_add_pd(
+        _mm256_mul_pd(latitude, latitude),
+        _mm256_mul_pd(
+            _mm256_mul_pd(geo_cos_avx2(_mm256_mul_pd(from_latitude, radians)),
+                          geo_cos_avx2(_mm256_mul_pd(to_latitude, radians))),
+            _mm256_mul_pd(longitude, longitude)));
+    haversine = _mm256_min_pd(_mm256_set1_pd(1),
+                              _mm256_max_pd(_mm256_setzero_pd(), haversine));
+    root = _mm256_sqrt_pd(haversine);
+    angle = _mm256_mul_pd(_mm256_set1_pd(2), geo_asin_avx2(root));
+    mask = _mm256_cmp_pd(root, _mm256_set1_pd(0.5), _CMP_LE_OQ);
+    if (_mm256_movemask_pd(mask) != 0xf)
+        angle = _mm256_blendv_pd(
+            _mm256_sub_pd(
+                _mm256_set1_pd(GEO_PI),
+                _mm256_mul_pd(_mm256_set1_pd(4),
+                              geo_asin_avx2(_mm256_sqrt_pd(_mm256_mul_pd(
+                                  _mm256_sub_pd(_mm256_set1_pd(1), root),
+                                  _mm256_set1_pd(0.5)))))),
+            angle, mask);
+    return _mm256_mul_pd(angle, _mm256_set1_pd(GEO_EARTH_RADIUS));
+}
+
+/*
+ * four legs at a time, the last ones padded as with sse2.
+ */
+GEO_AVX2_TARGET void geo_legs_avx2(const double* latitudes,
+                                   const double* longitudes, double* legs,
+                                   unsigned int count) {
+    double tail_latitudes[GEO_AVX2_LANES + 1];
+    double tail_longitudes[GEO_AVX2_LANES + 1];
+    double tail_legs[GEO_AVX2_LANES];
+    unsigned int i, j;
+
+    for (i = 0; i + GEO_AVX2_LANES < count; i += GEO_AVX2_LANES)
+        _mm256_storeu_pd(legs + i,
+                         geo_leg_avx2(latitudes + i, longitudes + i));
+    if (i + 1 >= count)
+        return;
+    for (j = 0; j <= GEO_AVX2_LANES; j++) {
+        tail_latitudes[j] = latitudes[(i + j < count) ? i + j : count - 1];
+        tail_longitudes[j] = longitudes[(i + j < count) ? i + j : count - 1];
+    }
+    _mm256_storeu_pd(tail_legs,
+                     geo_leg_avx2(tail_latitudes, tail_longitudes));
+    for (j = 0; i + j + 1 < count; j++)
+        legs[i + j] = tail_legs[j];
+}
+#endif /* GEO_AVX2 */
+
+/*
+ * the widest kernel this processor runs.
+ */
+geo_kernel_t geo_pick_kernel(void) {
+#ifdef GEO_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return geo_legs_avx2;
+#endif
+#ifdef GEO_SSE2
+    return geo_legs_sse2;
+#else
+    return geo_legs_scalar;
+#endif
+}
+
+void geo_legs(const double* latitudes, const double* longitudes, double* legs,
+              unsigned int count) {
+    if (!geo_kernel)
+        geo_kernel = geo_pick_kernel();
+    geo_kernel(latitudes, longitudes, legs, count);
+}
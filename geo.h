@@ -0,0 +1,18 @@
+#ifndef GEO_HEADER
+#define GEO_HEADER
+
+/* mean radius of the earth, in kilometers */
+#define GEO_EARTH_RADIUS 6371.0
+
+/*
+ * great-circle distances (haversine), in kilometers, along a path of points
+ * given by their latitudes and longitudes, in degrees.
+ * legs[i] is the distance from point i to point i + 1, for the count - 1 legs.
+ * the work is done a vector of legs at a time when the processor can (with
+ * the same result as one at a time, except on the x87, which computes doubles
+ * with extra precision).
+ */
+void geo_legs(const double* latitudes, const double* longitudes, double* legs,
+              unsigned int count);
+
+#endif /* !GEO_HEADER */
@@ -0,0 +1,56 @@
+#include "hash.h"
+#include <limits.h>
+
+#if ULONG_MAX > 0xffffffffUL
+#define HASH_SEED 0x9e3779b97f4a7c15UL
+#define HASH_MULTIPLIER 0x517cc1b727220a95UL
+#define HASH_FINALIZER 0xbf58476d1ce4e5b9UL
+#else
+#define HASH_SEED 0x9e3779b9UL
+#define HASH_MULTIPLIER 0x27220a95UL
+#define HASH_FINALIZER 0x85ebca6bUL
+#endif
+
+#define WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define ROTATE(x, n) (((x) << (n)) | ((x) >> (WORD_BITS - (n))))
+
+/*
+ * mixes one word into the hash.
+ */
+__always_inline unsigned long hash_word(unsigned long hash,
+                                        unsigned long word) {
+    return (ROTATE(hash, 5) ^ word) * HASH_MULTIPLIER;
+}
+
+/*
+ * hashes a sequence of bytes, a whole word at a time.
+ * all the bits of the result are usable (the low ones are as good as the high
+ * ones).
+ */
+size_t hash_bytes(const char* str, size_t length) {
+    unsigned long hash = HASH_SEED ^ length;
+    unsigned long word;
+
+    for (; length >= sizeof(word); length -= sizeof(word)) {
+        memcpy(&word, str, sizeof(word));
+        hash = hash_word(hash, word);
+        str += sizeof(word);
+    }
+    /* the remaining bytes go in a zero-padded word */
+    if (length) {
+        word = 0;
+        memcpy(&word, str, length);
+        hash = hash_word(hash, word);
+    }
+
+    /* the multiplication only carries bits up, so they are brought down */
+    hash ^= hash >> (WORD_BITS / 2);
+    hash *= HASH_FINALIZER;
+    hash ^= hash >> (WORD_BITS / 2 - 3);
+    return hash;
+}
+
+/*
+ * hashes a null-terminated string.
+ */
+size_t hash_string(const char* str) { return hash_bytes(str, strlen(str)); }
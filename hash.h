@@ -0,0 +1,9 @@
+#ifndef HASH_HEADER
+#define HASH_HEADER
+#include <stddef.h>
+#include <string.h>
+
+size_t hash_bytes(const char* str, size_t length);
+size_t hash_string(const char* str);
+
+#endif /* !HASH_HEADER */
@@ -0,0 +1,261 @@
+#define _POSIX_C_SOURCE 200112L
+#include "input.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * whether the character separates the words of a command.
+ */
+__always_inline int input_is_delimiter(char c) {
+    return c == ' ' || c == '\t' || c == '\n';
+}
+
+/*
+ * maps the whole file to memory.
+ * private and writable, so lines can be cut and names unquoted in place.
+ * returns 0 if ok, -1 if the file isn't a (non empty) regular file or the
+ * mapping failed.
+ */
+int input_map(input_t* self) {
+    struct stat info;
+    void* data;
+
+    if (fstat(self->fd, &info) || !S_ISREG(info.st_mode) || info.st_size <= 0)
+        return -1;
+    data = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                self->fd, 0);
+    if (data == MAP_FAILED)
+        return -1;
+    posix_madvise(data, (size_t)info.st_size, POSIX_MADV_SEQUENTIAL);
+
+    self->data = data;
+    self->size = self->capacity = (size_t)info.st_size;
+    self->mapped = 1;
+    self->eof = 1;
+    return 0;
+}
+
+/*
+ * initializes the reader for the given file descriptor.
+ * idle (if not NULL) is called with the context whenever the reader is about
+ * to block, so the output can be flushed.
+ * returns 0 if ok, -1 if there wasn't memory for the buffer.
+ */
+int input_init(input_t* self, int fd, void (*idle)(void*), void* context) {
+    self->fd = fd;
+    self->idle = idle;
+    self->context = context;
+    self->size = self->position = self->scanned = 0;
+    self->mapped = self->eof = 0;
+    self->tail = NULL;
+    if (!input_map(self))
+        return 0;
+
+    self->capacity = INPUT_BLOCK_SIZE;
+    if (!(self->data = malloc(self->capacity))) {
+        self->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * unmaps or frees the input.
+ */
+void input_destroy(input_t* self) {
+    if (self->mapped)
+        munmap(self->data, self->capacity);
+    else
+        free(self->data);
+    free(self->tail);
+    self->data = self->tail = NULL;
+    self->size = self->capacity = self->position = self->scanned = 0;
+}
+
+/*
+ * reads another block, after the bytes not given out yet (which are moved to
+ * the start of the buffer first).
+ * returns the number of bytes read, 0 at the end of the file or on errors.
+ */
+size_t input_fill(input_t* self) {
+    char* data;
+    ssize_t count;
+
+    if (self->position) {
+        self->size -= self->position;
+        memmove(self->data, self->data + self->position, self->size);
+        self->position = 0;
+    }
+    /* there has to be room for the '\0' after the last line */
+    if (self->capacity - self->size < INPUT_BLOCK_SIZE / 2) {
+        if (!(data = realloc(self->data, self->capacity * 2)))
+            return 0;
+        self->data = data;
+        self->capacity *= 2;
+    }
+
+    if (self->idle)
+        self->idle(self->context);
+    do
+        count = read(self->fd, self->data + self->size,
+                     self->capacity - self->size - 1);
+    while (count < 0 && errno == EINTR);
+    if (count <= 0)
+        return 0;
+    self->size += (size_t)count;
+    return (size_t)count;
+}
+
+/*
+ * gives out the next line of the input, without its newline and terminated by
+ * a '\0' (written over the newline).
+ * the line stays valid until the next call. its length is stored in length (if
+ * not NULL).
+ * returns NULL at the end of the input.
+ */
+char* input_line(input_t* self, size_t* length) {
+    char *line, *end;
+    size_t size;
+
+    for (;;) {
+        line = self->data + self->position;
+        end = memchr(line + self->scanned, '\n',
+                     self->size - self->position - self->scanned);
+        if (end)
+            break;
+        self->scanned = self->size - self->position;
+        if (self->eof || !input_fill(self)) {
+            self->eof = 1;
+            break;
+        }
+    }
+
+    if (end) {
+        size = (size_t)(end - line);
+        self->position += size + 1;
+    } else {
+        /* the last line, without a newline (if there is one at all) */
+        if (!(size = self->size - self->position))
+            return NULL;
+        self->position = self->size;
+        if (self->mapped) {
+            /* there may be no room for the '\0' after the mapping */
+            free(self->tail);
+            if (!(self->tail = malloc(size + 1)))
+                return NULL;
+            memcpy(self->tail, line, size);
+            line = self->tail;
+        }
+        end = line + size;
+    }
+    *end = '\0';
+    self->scanned = 0;
+    if (length)
+        *length = size;
+    return line;
+}
+
+/*
+ * splits the next word (up to a space, tab or newline) from the given string,
+ * cutting it in place with a '\0'.
+ * the cursor is left after the word. its length is stored in length (if not
+ * NULL).
+ * returns NULL if there are no more words.
+ */
+char* input_word(char** cursor, size_t* length) {
+    char *word, *end;
+
+    for (word = *cursor; input_is_delimiter(*word); word++)
+        ;
+    if (!*word)
+        return NULL;
+    for (end = word; *end && !input_is_delimiter(*end); end++)
+        ;
+
+    *cursor = (*end) ? end + 1 : end;
+    *end = '\0';
+    if (length)
+        *length = (size_t)(end - word);
+    return word;
+}
+
+/*
+ * same as input_word(), but the name may also be between quotes (and so have
+ * spaces in it). the quotes are left out.
+ */
+char* input_name(char** cursor, size_t* length) {
+    char *name, *end;
+
+    for (name = *cursor; input_is_delimiter(*name); name++)
+        ;
+    if (*name != '"')
+        return input_word(cursor, length);
+
+    name++;
+    if (!(end = strchr(name, '"')))
+        end = name + strlen(name);
+
+    *cursor = (*end) ? end + 1 : end;
+    *end = '\0';
+    if (length)
+        *length = (size_t)(end - name);
+    return name;
+}
+
+/*
+ * parses a decimal number, as strtod() (and atof()) would.
+ * the usual case (at most 53 bits of digits, scaled by at most 10^22) is
+ * worked out exactly with a single product or quotient. anything else is
+ * left to strtod().
+ */
+double input_number(const char* str) {
+    static const double powers[] = {1e0,  1e1,  1e2,  1e3,  1e4,  1e5,
+                                    1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                    1e12, 1e13, 1e14, 1e15, 1e16, 1e17,
+                                    1e18, 1e19, 1e20, 1e21, 1e22};
+    const char* current = str;
+    unsigned long mantissa = 0;
+    long exponent = 0, written = 0;
+    int negative = 0, exponent_negative = 0, digits = 0;
+    double value;
+
+    if (*current == '-' || *current == '+')
+        negative = (*current++ == '-');
+    for (; *current >= '0' && *current <= '9'; current++, digits++) {
+        if (mantissa > INPUT_FAST_MANTISSA / 10)
+            return strtod(str, NULL);
+        mantissa = mantissa * 10 + (unsigned long)(*current - '0');
+    }
+    if (*current == '.')
+        for (current++; *current >= '0' && *current <= '9';
+             current++, digits++, exponent--) {
+            if (mantissa > INPUT_FAST_MANTISSA / 10)
+                return strtod(str, NULL);
+            mantissa = mantissa * 10 + (unsigned long)(*current - '0');
+        }
+    if (!digits)
+        return strtod(str, NULL);
+    if (*current == 'e' || *current == 'E') {
+        current++;
+        if (*current == '-' || *current == '+')
+            exponent_negative = (*current++ == '-');
+        if (*current < '0' || *current > '9')
+            return strtod(str, NULL);
+        for (; *current >= '0' && *current <= '9'; current++)
+            if ((written = written * 10 + (*current - '0')) > 1000)
+                return strtod(str, NULL);
+        exponent += (exponent_negative) ? -written : written;
+    }
+    if (*current || mantissa > INPUT_FAST_MANTISSA || exponent > 22 ||
+        exponent < -22)
+        return strtod(str, NULL);
+
+    value = (double)mantissa;
+    value = (exponent < 0) ? value / powers[-exponent]
+                           : value * powers[exponent];
+    return (negative) ? -value : value;
+}
@@ -0,0 +1,42 @@
+#ifndef INPUT_HEADER
+#define INPUT_HEADER
+#include <limits.h>
+#include <stddef.h>
+
+/* bytes asked from the file with each read */
+#define INPUT_BLOCK_SIZE 65536
+
+/* the biggest mantissa input_number() turns into a double exactly */
+#if ULONG_MAX > 0xffffffffUL
+#define INPUT_FAST_MANTISSA 9007199254740992UL /* 2^53 */
+#else
+#define INPUT_FAST_MANTISSA 4000000000UL
+#endif
+
+/*
+ * reader of the commands, a line at a time.
+ * the input is mapped to memory when it is a regular file, or else read in big
+ * blocks; either way lines are handed out in place, without being copied.
+ */
+typedef struct input {
+    char* data;
+    size_t size;     /* bytes of data holding input */
+    size_t capacity; /* always bigger than size, if data was read */
+    size_t position; /* first byte not given out yet */
+    size_t scanned;  /* bytes after position known not to be a newline */
+    int fd;
+    int mapped;
+    int eof;
+    char* tail; /* copy of a mapped last line without a newline */
+    void (*idle)(void*); /* called before waiting for more input */
+    void* context;       /* given to idle */
+} input_t;
+
+int input_init(input_t* self, int fd, void (*idle)(void*), void* context);
+void input_destroy(input_t* self);
+char* input_line(input_t* self, size_t* length);
+char* input_word(char** cursor, size_t* length);
+char* input_name(char** cursor, size_t* length);
+double input_number(const char* str);
+
+#endif /* !INPUT_HEADER */
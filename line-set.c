@@ -0,0 +1,179 @@
+#include "line-set.h"
+
+#define INDEX_CAPACITY(self) ((self)->capacity * 2)
+#define INDEX_SIZE(self) (sizeof(unsigned int) * INDEX_CAPACITY(self))
+#define ITEMS_SIZE(self) (sizeof(line_set_item_t) * (self)->capacity)
+
+/*
+ * first slot of the index for the given id.
+ */
+__always_inline unsigned int line_set_slot(const line_set_t* self,
+                                           unsigned int id) {
+    return (id * 2654435761u) & (INDEX_CAPACITY(self) - 1);
+}
+
+/*
+ * returns the index slot holding the given id, or the empty slot where it
+ * would be.
+ */
+unsigned int line_set_find_slot(const line_set_t* self, unsigned int id) {
+    unsigned int mask = INDEX_CAPACITY(self) - 1;
+    unsigned int i = line_set_slot(self, id);
+    while (self->index[i] && self->items[self->index[i] - 1].id != id)
+        i = (i + 1) & mask;
+    return i;
+}
+
+/*
+ * returns the position of the given id in the items, or -1 if it isn't there.
+ */
+long line_set_position(const line_set_t* self, unsigned int id) {
+    unsigned int i;
+    if (!self->index) {
+        for (i = 0; i < self->size; i++)
+            if (self->items[i].id == id)
+                return i;
+        return -1;
+    }
+    i = line_set_find_slot(self, id);
+    return (self->index[i]) ? (long)self->index[i] - 1 : -1;
+}
+
+/*
+ * initializes an empty set.
+ */
+void line_set_init(line_set_t* self) {
+    self->items = self->inline_items;
+    self->index = NULL;
+    self->size = 0;
+    self->capacity = LINE_SET_INLINE;
+}
+
+/*
+ * the set was moved (copied as it was) to where it is: small sets point back
+ * into themselves.
+ */
+void line_set_relocate(line_set_t* self) {
+    if (!self->index)
+        self->items = self->inline_items;
+}
+
+/*
+ * moves the set to heap arrays with room for twice as many items, rebuilding
+ * its index.
+ * returns 0 if ok, -1 if there wasn't memory.
+ */
+int line_set_grow(line_set_t* self, sizepool_t* pool) {
+    line_set_t bigger;
+    unsigned int i;
+
+    bigger.capacity = self->capacity * 2;
+    bigger.size = self->size;
+    if (!(bigger.items = sizepool_alloc(pool, ITEMS_SIZE(&bigger))))
+        return -1;
+    if (!(bigger.index = sizepool_alloc(pool, INDEX_SIZE(&bigger)))) {
+        sizepool_free(pool, bigger.items, ITEMS_SIZE(&bigger));
+        return -1;
+    }
+    memcpy(bigger.items, self->items, sizeof(line_set_item_t) * self->size);
+    memset(bigger.index, 0, INDEX_SIZE(&bigger));
+    for (i = 0; i < bigger.size; i++)
+        bigger.index[line_set_find_slot(&bigger, bigger.items[i].id)] = i + 1;
+
+    line_set_clear(self, pool);
+    self->items = bigger.items;
+    self->index = bigger.index;
+    self->size = bigger.size;
+    self->capacity = bigger.capacity;
+    return 0;
+}
+
+/*
+ * adds one to the counter of the given id, adding the id if needed.
+ * returns 1 if it is a new member, 0 if it already was one and -1 if there
+ * wasn't memory for it.
+ */
+int line_set_add(line_set_t* self, sizepool_t* pool, unsigned int id) {
+    long position = line_set_position(self, id);
+    if (position >= 0) {
+        self->items[position].count++;
+        return 0;
+    }
+
+    if (self->size == self->capacity && line_set_grow(self, pool))
+        return -1;
+
+    self->items[self->size].id = id;
+    self->items[self->size].count = 1;
+    self->size++;
+    if (self->index)
+        self->index[line_set_find_slot(self, id)] = self->size;
+    return 1;
+}
+
+/*
+ * takes the given slot out of the index, moving back the entries after it
+ * that would no longer be reachable (linear probing deletion).
+ */
+void line_set_unindex(line_set_t* self, unsigned int hole) {
+    unsigned int mask = INDEX_CAPACITY(self) - 1;
+    unsigned int i = hole, home;
+    while (1) {
+        i = (i + 1) & mask;
+        if (!self->index[i])
+            break;
+        home = line_set_slot(self, self->items[self->index[i] - 1].id);
+        /* the entry can fill the hole if its home isn't after the hole */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            self->index[hole] = self->index[i];
+            hole = i;
+        }
+    }
+    self->index[hole] = 0;
+}
+
+/*
+ * takes one from the counter of the given id, removing it once it gets to zero.
+ * returns 1 if the id left the set, 0 otherwise.
+ */
+int line_set_remove(line_set_t* self, sizepool_t* pool, unsigned int id) {
+    long position = line_set_position(self, id);
+    unsigned int last;
+
+    if (position < 0 || --self->items[position].count)
+        return 0;
+
+    if (self->index)
+        line_set_unindex(self, line_set_find_slot(self, id));
+
+    /* the last item takes the place of the removed one */
+    last = --self->size;
+    if ((unsigned int)position != last) {
+        self->items[position] = self->items[last];
+        if (self->index)
+            self->index[line_set_find_slot(self, self->items[position].id)] =
+                position + 1;
+    }
+
+    if (!self->size)
+        line_set_clear(self, pool);
+    return 1;
+}
+
+/*
+ * checks if the given id is in the set.
+ */
+int line_set_has(const line_set_t* self, unsigned int id) {
+    return line_set_position(self, id) >= 0;
+}
+
+/*
+ * removes every member of the set, giving back its memory.
+ */
+void line_set_clear(line_set_t* self, sizepool_t* pool) {
+    if (self->index) {
+        sizepool_free(pool, self->items, ITEMS_SIZE(self));
+        sizepool_free(pool, self->index, INDEX_SIZE(self));
+    }
+    line_set_init(self);
+}
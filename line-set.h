@@ -0,0 +1,36 @@
+#ifndef LINE_SET_HEADER
+#define LINE_SET_HEADER
+#include "pool.h"
+
+/* members kept in the set itself, before it needs a hashed index */
+#define LINE_SET_INLINE 4
+
+typedef struct {
+    unsigned int id;
+    int count; /* times the line was added and not yet removed */
+} line_set_item_t;
+
+/*
+ * set of line ids (each with a counter), for the lines passing by a stop.
+ * the members are kept together in an array, in no particular order. small
+ * sets are scanned; bigger ones move to the heap and get an open-addressing
+ * index from id to position.
+ * small sets point into themselves, so a set that was moved must be relocated
+ * before it is used again.
+ */
+typedef struct line_set {
+    line_set_item_t* items;
+    unsigned int* index; /* position + 1 of each id (0 is empty) or NULL */
+    unsigned int size;
+    unsigned int capacity;
+    line_set_item_t inline_items[LINE_SET_INLINE];
+} line_set_t;
+
+void line_set_init(line_set_t* self);
+void line_set_relocate(line_set_t* self);
+int line_set_add(line_set_t* self, sizepool_t* pool, unsigned int id);
+int line_set_remove(line_set_t* self, sizepool_t* pool, unsigned int id);
+int line_set_has(const line_set_t* self, unsigned int id);
+void line_set_clear(line_set_t* self, sizepool_t* pool);
+
+#endif /* !LINE_SET_HEADER */
@@ -1,4 +1,150 @@
 #include "linked-hash-table.h"
+#include "stats.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* high bit of a control byte, only set for empty and deleted slots */
+#define LHT_CTRL_FREE 0x80
+#define FINGERPRINT(hash) ((unsigned char)((hash)&0x7f))
+
+/*
+ * returns a bitmask of the slots in the group whose control byte is the given
+ * one (bit i for the slot i of the group).
+ */
+__always_inline unsigned int lht_group_match(const unsigned char* group,
+                                             unsigned char byte) {
+#ifdef __SSE2__
+    __m128i ctrl = _mm_loadu_si128((const __m128i*)group);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)byte)));
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < LHT_GROUP_WIDTH; i++)
+        if (group[i] == byte)
+            mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/*
+ * returns a bitmask of the empty or deleted slots in the group.
+ */
+__always_inline unsigned int lht_group_free(const unsigned char* group) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    unsigned int mask = 0;
+    int i;
+    for (i = 0; i < LHT_GROUP_WIDTH; i++)
+        if (group[i] & LHT_CTRL_FREE)
+            mask |= 1u << i;
+    return mask;
+#endif
+}
+
+/*
+ * alocates the slots of a table with the given capacity, all empty.
+ * returns 0 if ok, -1 if there wasn't memory.
+ */
+int lht_table_init(lht_table_t* table, size_t capacity) {
+    if (!(table->ctrl = malloc(capacity)))
+        return -1;
+    if (!(table->slots = malloc(sizeof(lht_entry_t*) * capacity))) {
+        free(table->ctrl);
+        table->ctrl = NULL;
+        return -1;
+    }
+    memset(table->ctrl, LHT_CTRL_EMPTY, capacity);
+    table->capacity = capacity;
+    table->size = 0;
+    table->used = 0;
+    return 0;
+}
+
+/*
+ * frees the slots of a table (not the entries).
+ */
+void lht_table_free(lht_table_t* table) {
+    free(table->ctrl);
+    free(table->slots);
+    table->ctrl = NULL;
+    table->slots = NULL;
+    table->capacity = table->size = table->used = 0;
+}
+
+/*
+ * returns the index of the slot holding the given key.
+ * groups are probed in triangular steps, which visits all of them.
+ * in case there isn't any correspondance, returns -1.
+ */
+ssize_t lht_table_find(const lht_table_t* table, const char* key,
+                       size_t hash) {
+    size_t mask = table->capacity / LHT_GROUP_WIDTH - 1;
+    size_t group = (hash >> 7) & mask;
+    size_t stride = 0, i;
+    const unsigned char* ctrl;
+    unsigned int match;
+
+    STATS_ADD(STATS_LOOKUPS, 1);
+    while (1) {
+        STATS_ADD(STATS_PROBES, 1);
+        ctrl = table->ctrl + group * LHT_GROUP_WIDTH;
+        /* only the keys with the same fingerprint are compared */
+        match = lht_group_match(ctrl, FINGERPRINT(hash));
+        while (match) {
+            i = group * LHT_GROUP_WIDTH + __builtin_ctz(match);
+            if (table->slots[i]->hash == hash &&
+                !strcmp(table->slots[i]->key, key))
+                return i;
+            match &= match - 1;
+        }
+        /* the key would have been put in this group */
+        if (lht_group_match(ctrl, LHT_CTRL_EMPTY))
+            return -1;
+        group = (group + ++stride) & mask;
+    }
+}
+
+/*
+ * puts the entry in the first free (empty or deleted) slot of its probe
+ * sequence.
+ */
+void lht_table_place(lht_table_t* table, lht_entry_t* entry) {
+    size_t mask = table->capacity / LHT_GROUP_WIDTH - 1;
+    size_t group = (entry->hash >> 7) & mask;
+    size_t stride = 0, i;
+    unsigned int free_slots;
+
+    while (!(free_slots =
+                 lht_group_free(table->ctrl + group * LHT_GROUP_WIDTH)))
+        group = (group + ++stride) & mask;
+
+    i = group * LHT_GROUP_WIDTH + __builtin_ctz(free_slots);
+    if (table->ctrl[i] == LHT_CTRL_EMPTY)
+        table->used++;
+    table->ctrl[i] = FINGERPRINT(entry->hash);
+    table->slots[i] = entry;
+    table->size++;
+    entry->i = i;
+}
+
+/*
+ * marks the given slot as free.
+ * a group with an empty slot never had a probe go past it, so in that case the
+ * slot can become empty again. otherwise it must be a tombstone.
+ */
+void lht_table_clear(lht_table_t* table, size_t i) {
+    const unsigned char* group =
+        table->ctrl + (i & ~(size_t)(LHT_GROUP_WIDTH - 1));
+    if (lht_group_match(group, LHT_CTRL_EMPTY)) {
+        table->ctrl[i] = LHT_CTRL_EMPTY;
+        table->used--;
+    } else
+        table->ctrl[i] = LHT_CTRL_DELETED;
+    table->size--;
+}
 
 /*
  * alocates memory for an lht and initializes it.
@@ -7,25 +153,23 @@
  */
 lht_t* lht_init(void) {
     lht_t* new = (lht_t*)malloc(sizeof(lht_t));
-    int i;
     if (!new) {
         fprintf(stderr, "couldn't get memory for the new hash table!\n");
         return NULL;
     }
-    /* allocs the hash table */
-    new->raw = malloc(sizeof(void*) * INIT_HASH);
-    if (!new->raw) {
+    /* allocs the (small) hash table, it grows as entries come in */
+    if (lht_table_init(&new->table, LHT_MIN_CAPACITY)) {
         free(new);
         fprintf(stderr, "couldn't get memory for the new hash table!\n");
         return NULL;
     }
-    /* and initializes it */
-    for (i = 0; i < INIT_HASH; i++) {
-        new->raw[i] = NULL;
-    }
     /* initializes the rest of the attributes */
+    new->old.ctrl = NULL;
+    new->old.slots = NULL;
+    new->old.capacity = new->old.size = new->old.used = 0;
+    new->migrated = 0;
     new->size = 0;
-    new->capacity = INIT_HASH;
+    pool_init(&new->entries, sizeof(lht_entry_t));
     new->first = NULL;
     new->last = NULL;
     return new;
@@ -39,65 +183,144 @@ void lht_destroy(lht_t* self) {
     if (!self)
         return;
 
-    free(self->raw);
+    lht_table_free(&self->old);
+    lht_table_free(&self->table);
+    pool_reset(&self->entries);
     free(self);
 }
 
 /*
- * main, string-based, hash function.
+ * removes every entry of the lht at once (the values aren't touched) and
+ * shrinks it back to its starting size.
  */
-size_t calculate_hash1(const char* str) {
-    unsigned long hash = 0;
-    int c;
+void lht_clear(lht_t* self) {
+    lht_table_t table;
+
+    pool_reset(&self->entries);
+    lht_table_free(&self->old);
+    if (self->table.capacity > LHT_MIN_CAPACITY &&
+        !lht_table_init(&table, LHT_MIN_CAPACITY)) {
+        lht_table_free(&self->table);
+        self->table = table;
+    } else {
+        memset(self->table.ctrl, LHT_CTRL_EMPTY, self->table.capacity);
+        self->table.size = self->table.used = 0;
+    }
+    self->migrated = 0;
+    self->size = 0;
+    self->first = NULL;
+    self->last = NULL;
+}
 
-    while ((c = *str++))
-        hash = hash * 31 + c;
+/*
+ * moves up to the given number of slots from the table being drained into the
+ * current one.
+ * it is what spreads the cost of a resize across many operations.
+ */
+void lht_migrate(lht_t* self, size_t steps) {
+    lht_entry_t* entry;
+    while (self->old.ctrl && steps--) {
+        /* nothing left to move */
+        if (!self->old.size || self->migrated == self->old.capacity) {
+            lht_table_free(&self->old);
+            return;
+        }
+        if (!(self->old.ctrl[self->migrated] & LHT_CTRL_FREE)) {
+            entry = self->old.slots[self->migrated];
+            lht_table_clear(&self->old, self->migrated);
+            lht_table_place(&self->table, entry);
+        }
+        self->migrated++;
+    }
+}
 
-    return hash % INIT_HASH;
+/*
+ * a single step of an ongoing rehash.
+ * the old table may be a lot bigger (after a shrink), so the step grows with
+ * the ratio between the two.
+ */
+__always_inline void lht_rehash_step(lht_t* self) {
+    if (self->old.ctrl)
+        lht_migrate(self, LHT_MIGRATE_STEP * (self->old.capacity /
+                                                  self->table.capacity +
+                                              1));
 }
 
 /*
- * alternative, string-based, hash function.
- * for collision rehashing.
+ * starts moving the entries to a new table sized for the current number of
+ * entries (it may grow or shrink the lht).
+ * the actual moving is done incrementally, by lht_migrate().
+ * returns 0 if ok, -1 if there wasn't memory for the new table.
  */
-size_t calculate_hash2(const char* str) {
-    unsigned long hash = 5381;
-    int c;
+int lht_resize(lht_t* self) {
+    lht_table_t table;
+    size_t capacity = LHT_MIN_CAPACITY;
+
+    /* keeps the load under a half after the resize */
+    while (capacity < (self->size + 1) * 2)
+        capacity <<= 1;
+
+    /* there can only be one table being drained at a time */
+    if (self->old.ctrl)
+        lht_migrate(self, self->old.capacity + 1);
 
-    while ((c = *str++))
-        hash = ((hash << 5) + hash) + c;
+    if (lht_table_init(&table, capacity))
+        return -1;
 
-    return hash % INIT_HASH;
+    self->old = self->table;
+    self->table = table;
+    self->migrated = 0;
+    return 0;
 }
 
 /*
- * read:
- * https://www.scaler.com/topics/data-structures/double-hashing/
+ * makes room for the given number of new entries, so inserting them won't
+ * resize the lht.
+ * unlike lht_resize(), the entries are moved at once (along with any still in
+ * the table being drained): it is meant for batches.
+ * returns 0 if ok, -1 if there wasn't memory for the new table.
  */
-__always_inline size_t rehash(const char* str, const size_t prev, int round) {
-    return (prev + round * calculate_hash2(str)) % INIT_HASH;
+int lht_reserve(lht_t* self, size_t count) {
+    lht_table_t table;
+    lht_entry_t* entry;
+    size_t capacity = LHT_MIN_CAPACITY;
+
+    if (!self->old.ctrl &&
+        (self->table.used + count + 1) * 8 <= self->table.capacity * 7)
+        return 0;
+
+    while (capacity * 7 < (self->size + count + 1) * 8)
+        capacity <<= 1;
+    if (lht_table_init(&table, capacity))
+        return -1;
+    for (entry = self->first; entry; entry = entry->next)
+        lht_table_place(&table, entry);
+
+    lht_table_free(&self->old);
+    lht_table_free(&self->table);
+    self->table = table;
+    self->migrated = 0;
+    return 0;
 }
 
 /*
- * returns the index to the entry registered with the given key.
- * in case there isn't any correspondance, returns -1.
+ * finds the table and index of the slot holding the given key.
+ * returns NULL if the key isn't registered.
  */
-__always_inline ssize_t lht_get_index(lht_t* self, const char* key) {
-    size_t init, i;
-    int round = 1;
-    init = i = calculate_hash1(key);
-    /* jumping collisions with multiple-hashing */
-    while (self->raw[i]) {
-        /* found the key */
-        if (!strcmp(self->raw[i]->key, key))
-            return i;
-        /* didn't find it, rehashing */
-        i = rehash(key, init, round);
-        round++;
+lht_table_t* lht_lookup(lht_t* self, const char* key, size_t hash,
+                        size_t* i) {
+    ssize_t found;
+    if ((found = lht_table_find(&self->table, key, hash)) >= 0) {
+        *i = found;
+        return &self->table;
     }
-
-    /* the key doesn't exist */
-    return -1;
+    /* it may not have been moved yet */
+    if (self->old.ctrl &&
+        (found = lht_table_find(&self->old, key, hash)) >= 0) {
+        *i = found;
+        return &self->old;
+    }
+    return NULL;
 }
 
 /*
@@ -106,9 +329,17 @@ __always_inline ssize_t lht_get_index(lht_t* self, const char* key) {
  * else, it'll return NULL.
  */
 void* lht_get_entry(lht_t* self, const char* key) {
-    ssize_t i = lht_get_index(self, key);
+    return lht_get_entry_hashed(self, key, hash_string(key));
+}
+
+/*
+ * same as lht_get_entry(), for a key whose hash_string() is already known.
+ */
+void* lht_get_entry_hashed(lht_t* self, const char* key, size_t hash) {
+    size_t i;
+    lht_table_t* table = lht_lookup(self, key, hash, &i);
 
-    return (i >= 0) ? self->raw[i]->value : NULL;
+    return (table) ? table->slots[i]->value : NULL;
 }
 
 /*
@@ -119,27 +350,36 @@ void* lht_get_entry(lht_t* self, const char* key) {
  * if all went ok, returns 0.
  */
 int lht_insert_entry(lht_t* self, const char* key, void* value) {
-    size_t first_hash, i;
-    lht_entry_t* new = malloc(sizeof(lht_entry_t));
-    int round = 1;
-    first_hash = i = (size_t)calculate_hash1(key);
+    return lht_insert_entry_hashed(self, key, hash_string(key), value);
+}
+
+/*
+ * same as lht_insert_entry(), for a key whose hash_string() is already known.
+ */
+int lht_insert_entry_hashed(lht_t* self, const char* key, size_t hash,
+                            void* value) {
+    lht_entry_t* new = pool_alloc(&self->entries);
     if (!new) {
         fprintf(stderr, "couldn't get memory for the new hash table node!\n");
         return -1;
     }
-    /* jumping collisions */
-    while (self->raw[i]) {
-        i = rehash(key, first_hash, round);
-        round++;
+
+    lht_rehash_step(self);
+    /* keeps the load (tombstones included) at most at 7/8 */
+    if ((self->table.used + 1) * 8 > self->table.capacity * 7 &&
+        lht_resize(self) && self->table.used + 1 >= self->table.capacity) {
+        pool_free(&self->entries, new);
+        fprintf(stderr, "couldn't get memory for the new hash table!\n");
+        return -1;
     }
 
     /* adding info to the lht entry */
-    new->i = i;
     new->key = key;
+    new->hash = hash;
     new->value = value;
 
     /* adding to the hash table */
-    self->raw[i] = new;
+    lht_table_place(&self->table, new);
     self->size++;
 
     /* and linking */
@@ -157,33 +397,29 @@ int lht_insert_entry(lht_t* self, const char* key, void* value) {
 }
 
 /*
- * removes the entry from the given lht.
- * returns a pointer to the value.
+ * removes the entry in the given slot, taking it out of the list.
+ * returns a pointer to its value.
  */
-void* lht_leak_entry(lht_t* self, const char* key) {
-    void* value;
-    ssize_t i = lht_get_index(self, key);
-    /* the isn't an entry associated to the given key */
-    if (i < 0)
-        return NULL;
+void* lht_remove(lht_t* self, lht_table_t* table, size_t i) {
+    lht_entry_t* entry = table->slots[i];
+    void* value = entry->value;
 
-    value = self->raw[i]->value;
+    lht_table_clear(table, i);
 
     /* if it is not the last */
-    if (self->raw[i]->next)
-        self->raw[i]->next->prev = self->raw[i]->prev;
+    if (entry->next)
+        entry->next->prev = entry->prev;
     else
-        self->last = self->raw[i]->prev;
+        self->last = entry->prev;
 
     /* if it is not the first */
-    if (self->raw[i]->prev)
-        self->raw[i]->prev->next = self->raw[i]->next;
+    if (entry->prev)
+        entry->prev->next = entry->next;
     else
-        self->first = self->raw[i]->next;
+        self->first = entry->next;
 
-    /* frees the allocated space */
-    free(self->raw[i]);
-    self->raw[i] = NULL;
+    /* gives the entry back to the pool */
+    pool_free(&self->entries, entry);
 
     /* sanity-check cleanup */
     if (--self->size == 0) {
@@ -191,28 +427,108 @@ void* lht_leak_entry(lht_t* self, const char* key) {
         self->last = NULL;
     }
 
+    /* gives memory back once most of the entries are gone */
+    if (!self->old.ctrl && self->table.capacity > LHT_MIN_CAPACITY &&
+        self->size * 8 < self->table.capacity)
+        lht_resize(self);
+
     return value;
 }
 
+/*
+ * removes the entry from the given lht.
+ * returns a pointer to the value.
+ */
+void* lht_leak_entry(lht_t* self, const char* key) {
+    return lht_leak_entry_hashed(self, key, hash_string(key));
+}
+
+/*
+ * same as lht_leak_entry(), for a key whose hash_string() is already known.
+ */
+void* lht_leak_entry_hashed(lht_t* self, const char* key, size_t hash) {
+    lht_table_t* table;
+    size_t i;
+
+    lht_rehash_step(self);
+    /* the isn't an entry associated to the given key */
+    if (!(table = lht_lookup(self, key, hash, &i)))
+        return NULL;
+
+    return lht_remove(self, table, i);
+}
+
 /*
  * returns the number of entries registered in the lht.
  */
 size_t lht_get_size(lht_t* self) { return self->size; }
 
 /*
- * iterates over the given lht, according to the linking.
- * returns a pointer to the next entry or NULL if it reached the end.
- * if used the BEGIN flag, it'll go to the beggining of the table.
- * if used the KEEP flag, it'll keep going from where it was.
+ * the table (new or old) the entry is in.
  */
-void* lht_iter(lht_t* self, iter_setting setting) {
-    lht_entry_t* next;
-    if (setting == KEEP)
-        next = self->lht_iterator_current->next;
-    else
-        next = self->first;
-    self->lht_iterator_current = next;
-    return (next) ? next->value : NULL;
+lht_table_t* lht_table_of(lht_t* self, const lht_entry_t* entry) {
+    lht_table_t* table = &self->table;
+
+    /* the entry may still be waiting in the old table */
+    if (entry->i >= table->capacity || table->ctrl[entry->i] & LHT_CTRL_FREE ||
+        table->slots[entry->i] != entry)
+        table = &self->old;
+    return table;
+}
+
+/*
+ * starts an iterator at the first entry of the table (the oldest), fetching
+ * ahead what it is told to.
+ */
+void lht_iterator_init(lht_iterator_t* self, lht_t* table,
+                       lht_prefetch_t prefetch) {
+    int i;
+
+    self->table = table;
+    self->prefetch = prefetch;
+    self->current = NULL;
+    self->next = self->ahead = table->first;
+    for (i = 0; i < LHT_PREFETCH_DISTANCE && self->ahead; i++) {
+        if (prefetch == LHT_PREFETCH_VALUES)
+            __builtin_prefetch(self->ahead->value);
+        if ((self->ahead = self->ahead->next))
+            __builtin_prefetch(self->ahead);
+    }
+}
+
+/*
+ * moves on to the next entry.
+ * returns its value, or NULL if there are no more.
+ */
+void* lht_iterator_next(lht_iterator_t* self) {
+    lht_entry_t* ahead;
+
+    if (!(self->current = self->next))
+        return NULL;
+    self->next = self->current->next;
+    /* the entry ahead was fetched on the last step, its value can be now */
+    if ((ahead = self->ahead)) {
+        if (self->prefetch == LHT_PREFETCH_VALUES)
+            __builtin_prefetch(ahead->value);
+        if ((self->ahead = ahead->next))
+            __builtin_prefetch(self->ahead);
+    }
+    return self->current->value;
+}
+
+/*
+ * removes the entry the iterator gave out last (which must not be removed
+ * already), without losing its place.
+ * returns its value.
+ */
+void* lht_iterator_remove(lht_iterator_t* self) {
+    lht_t* table = self->table;
+    lht_entry_t* entry = self->current;
+
+    /* the iterator is past it already (and so is the prefetching) */
+    self->current = NULL;
+    lht_rehash_step(table);
+    return lht_remove(table, lht_table_of(table, entry), entry->i);
 }
 
 /*
@@ -220,25 +536,16 @@ void* lht_iter(lht_t* self, iter_setting setting) {
  * returns NULL if the lht is empty.
  */
 void* lht_pop_entry(lht_t* self) {
-    lht_entry_t* tmp;
-    void* corn; /* cus popcorn lol */
+    lht_entry_t* entry;
+    lht_table_t* table;
 
     /* no entries */
-    if (!self->last)
+    if (!(entry = self->last))
         return NULL;
 
-    /* remove entry and bypass linking */
-    self->raw[self->last->i] = NULL;
-    corn = self->last->value;
-    tmp = self->last->prev;
-    free(self->last);
-    self->last = tmp;
-
-    /* in case there isn't anymore entries left. */
-    if (--self->size == 0) {
-        self->first = NULL;
-        self->last = NULL;
-    }
+    lht_rehash_step(self);
+    table = lht_table_of(self, entry);
 
-    return corn;
+    /* cus popcorn lol */
+    return lht_remove(self, table, entry->i);
 }
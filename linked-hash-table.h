@@ -1,41 +1,96 @@
 #ifndef LHT_HEADER
+#define LHT_HEADER
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
 
-/* just a decently large prime number */
-#define INIT_HASH 216091
+#include "hash.h"
+#include "pool.h"
+
+/* slots whose control bytes are scanned together */
+#define LHT_GROUP_WIDTH 16
+/* starting number of slots (must be a power of two, at least a group) */
+#define LHT_MIN_CAPACITY LHT_GROUP_WIDTH
+/* slots of the old table moved to the new one on each mutation */
+#define LHT_MIGRATE_STEP 8
+/* entries an iterator fetches ahead of the one it gives out */
+#define LHT_PREFETCH_DISTANCE 4
+
+/* control bytes (a full slot stores the low 7 bits of its key's hash) */
+#define LHT_CTRL_EMPTY 0x80
+#define LHT_CTRL_DELETED 0xfe
 
 typedef struct lht_entry {
     const char* key;
+    size_t hash; /* hash_string() of the key */
     void* value;
     struct lht_entry* next;
     struct lht_entry* prev;
     unsigned long i;
 } lht_entry_t;
 
+/*
+ * one open-addressing slot array.
+ * ctrl[i] tells if slots[i] is empty, deleted or full (and then holds a
+ * fingerprint of the key), so probing only touches entries that may match.
+ */
+typedef struct lht_table {
+    unsigned char* ctrl;
+    lht_entry_t** slots;
+    size_t capacity;
+    size_t size; /* live entries */
+    size_t used; /* live entries plus tombstones */
+} lht_table_t;
+
 typedef struct lht {
-    lht_entry_t** raw;
+    lht_table_t table;
+    /* table still being drained by an incremental rehash */
+    lht_table_t old;
+    size_t migrated;
     size_t size;
-    size_t capacity;
+    pool_t entries;
     lht_entry_t* first;
     lht_entry_t* last;
-    lht_entry_t* lht_iterator_current;
 } lht_t;
 
+/* what an iterator fetches ahead of the entry it gives out */
 typedef enum {
-    BEGIN,
-    KEEP
-} iter_setting;
+    LHT_PREFETCH_ENTRIES, /* for tables whose values aren't pointers */
+    LHT_PREFETCH_VALUES   /* the entries, and then what their values point to */
+} lht_prefetch_t;
+
+/*
+ * cursor over the entries of a lht, in the order they were inserted.
+ * any number of them can walk a table at once (as long as it doesn't change),
+ * and the entry an iterator gave out last can be removed through it.
+ * the entries a few steps ahead are prefetched on the way, and their values
+ * too if asked for.
+ */
+typedef struct {
+    lht_t* table;
+    lht_prefetch_t prefetch;
+    lht_entry_t* current; /* given out last, NULL once removed */
+    lht_entry_t* next;
+    lht_entry_t* ahead; /* the farthest entry prefetched */
+} lht_iterator_t;
 
 lht_t* lht_init(void);
 void lht_destroy(lht_t* self);
+void lht_clear(lht_t* self);
 int lht_insert_entry(lht_t* self, const char* key, void* value);
+int lht_insert_entry_hashed(lht_t* self, const char* key, size_t hash,
+                            void* value);
 void* lht_leak_entry(lht_t* self, const char* key);
+void* lht_leak_entry_hashed(lht_t* self, const char* key, size_t hash);
 void* lht_get_entry(lht_t* self, const char* key);
+void* lht_get_entry_hashed(lht_t* self, const char* key, size_t hash);
 void* lht_pop_entry(lht_t* self);
-void* lht_iter(lht_t* table, iter_setting setting);
+void lht_iterator_init(lht_iterator_t* self, lht_t* table,
+                       lht_prefetch_t prefetch);
+void* lht_iterator_next(lht_iterator_t* self);
+void* lht_iterator_remove(lht_iterator_t* self);
 size_t lht_get_size(lht_t* self);
+int lht_reserve(lht_t* self, size_t count);
 
 #endif /* !LHT_HEADER */
@@ -1,15 +1,93 @@
 #include "main.h"
+#include "geo.h"
+#include "input.h"
 #include "linked-hash-table.h"
+#include "output.h"
+#include "pool.h"
+#include "readers.h"
+#include "route.h"
+#include "server.h"
+#include "snapshot.h"
+#include "spatial.h"
+#include "stats.h"
+#include "stop-table.h"
 
 lht_t* lines;
-lht_t* stops;
+lht_t* stops; /* ids of the stops (plus one, as none can be NULL) by name */
+stop_table_t stop_table;
+
+/* where all the memory of the network comes from */
+pool_t line_pool;
+sizepool_t blocks; /* names and line sets */
+
+/* lines by id, and the ids given back by removed lines */
+line_t** line_ids;
+unsigned int num_line_ids;
+unsigned int* free_line_ids;
+unsigned int num_free_line_ids;
+unsigned int line_ids_capacity;
+
+/* ids of the stops with more than one line, in the order they were added */
+unsigned int* interchanges;
+unsigned int num_interchanges;
+unsigned int interchanges_capacity;
+unsigned long num_stops_added;
 
 /*
- * returns a pointer to the stop with the given name.
- * returns NULL if the stop doesn't exit.
+ * bulk loading: the p, c and l commands are staged (as they came, one after
+ * the other) and only run when the batch ends, keeping the per-stop indexes
+ * unsorted until then.
  */
-__always_inline stop_t* get_stop(const char* name) {
-    return (stop_t*)lht_get_entry(stops, name);
+int bulk_loading;
+char* staged;
+size_t staged_size;
+size_t staged_capacity;
+size_t num_staged_stops;
+size_t num_staged_lines;
+int deferring; /* the staged commands are being run */
+unsigned int* unsorted_stops;
+unsigned int num_unsorted_stops;
+unsigned int unsorted_stops_capacity;
+int interchanges_unsorted;
+server_client_t* bulk_client; /* in server mode, the one bulk loading */
+
+/* adjacency arrays of the network, for the t command */
+route_graph_t routes;
+
+/* the locations of the stops, for the n and g commands */
+spatial_t spatial;
+
+/* threads printing the c, p and i listings (none unless asked for) */
+readers_t readers;
+
+/*
+ * the id of a stop, as kept in the stops' hash table.
+ */
+__always_inline void* stop_entry(unsigned int stop) {
+    return (void*)(size_t)(stop + 1);
+}
+
+/*
+ * the id of the stop kept in the stops' hash table (NO_STOP for NULL).
+ */
+__always_inline unsigned int entry_stop(void* entry) {
+    return (unsigned int)((size_t)entry - 1);
+}
+
+/*
+ * returns the id of the stop with the given name.
+ * returns NO_STOP if the stop doesn't exit.
+ */
+__always_inline unsigned int get_stop(const char* name) {
+    return entry_stop(lht_get_entry(stops, name));
+}
+
+/*
+ * same as get_stop(), for when the name's hash_string() is already known
+ * (e.g. it is going to be used again).
+ */
+__always_inline unsigned int get_stop_hashed(const char* name, size_t hash) {
+    return entry_stop(lht_get_entry_hashed(stops, name, hash));
 }
 
 /*
@@ -21,126 +99,532 @@ __always_inline line_t* get_line(const char* name) {
 }
 
 /*
- * simple bubble sort for sorting a list of strings.
+ * same as get_line(), for when the name's hash_string() is already known.
  */
-void sort(char** list, int size) {
-    int i, j;
-    char* temp;
-    for (i = 0; i < size - 1; i++) {
-        for (j = 0; j < size - i - 1; j++) {
-            if (strcmp(list[j], list[j + 1]) > 0) {
-                temp = list[j];
-                list[j] = list[j + 1];
-                list[j + 1] = temp;
-            }
-        }
-    }
+__always_inline line_t* get_line_hashed(const char* name, size_t hash) {
+    return (line_t*)lht_get_entry_hashed(lines, name, hash);
 }
 
 /*
  * checks if a given line has the given stop.
  */
-int intersects(const line_t* line, const stop_t* intersection) {
-    stop_node_t* current = line->origin;
-    while (current) {
-        if (!strcmp(current->raw->name, intersection->name))
+int intersects(const line_t* line, unsigned int intersection) {
+    const line_stop_t* current = line->stops + line->first;
+    const line_stop_t* end = current + line->num_stops;
+    for (; current < end; current++)
+        if (current->stop == intersection)
             return 1;
-        current = current->next;
-    }
     return 0;
 }
 
 /*
  * lists all lines in the system.
  */
-void list_all_lines(void) {
+void list_all_lines(output_t* out) {
     line_t* current;
-    current = lht_iter(lines, BEGIN);
-    while (current) {
-        printf("%s", current->name);
-        if (current->origin && current->destination) {
+    lht_iterator_t iterator;
+    const line_stop_t* route;
+    readers_job_t* job = NULL;
+    readers_line_t single, *row = &single;
+
+    /* with readers, the lines are copied for one of them to print */
+    if (readers.num_threads &&
+        (job = readers_job('c', lht_get_size(lines), sizeof(readers_line_t),
+                           0)))
+        row = job->rows;
+    lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+    while ((current = lht_iterator_next(&iterator))) {
+        row->name = current->name;
+        row->origin = row->destination = NULL;
+        if (current->num_stops) {
             /* if it already has stops */
-            printf(" %s %s", current->origin->raw->name,
-                   current->destination->raw->name);
+            route = current->stops + current->first;
+            row->origin = stop_table.names[route[0].stop];
+            row->destination =
+                stop_table.names[route[current->num_stops - 1].stop];
         }
-        printf(" %d %.2f %.2f\n", current->num_stops, current->total_cost,
-               current->total_duration);
-
-        current = lht_iter(lines, KEEP);
+        row->num_stops = current->num_stops;
+        row->total_cost = current->total_cost;
+        row->total_duration = current->total_duration;
+        if (job)
+            row++;
+        else
+            readers_print_line(out, row);
     }
+    if (job)
+        readers_submit(&readers, job);
 }
 
 /*
  * lists the stops in the given line.
  */
-void list_single_line(line_t* line) {
-    stop_node_t* current = line->origin;
+void list_single_line(output_t* out, line_t* line) {
+    const line_stop_t* current = line->stops + line->first;
+    const line_stop_t* end = current + line->num_stops;
 
-    if (current) {
-        printf("%s", current->raw->name);
-        current = current->next;
-    } else /* don't print anything */
+    if (current == end) /* don't print anything */
         return;
-    while (current) {
-        printf(", %s", current->raw->name);
-        current = current->next;
+    output_string(out, stop_table.names[current->stop]);
+    for (current++; current < end; current++) {
+        output_bytes(out, ", ", 2);
+        output_string(out, stop_table.names[current->stop]);
     }
-    printf("\n");
+    output_char(out, '\n');
 }
 
 /*
  * same as list_single_line() but prints in the opposite order.
  */
-void list_single_line_inverted(line_t* line) {
-    stop_node_t* current = line->destination;
+void list_single_line_inverted(output_t* out, line_t* line) {
+    const line_stop_t* begin = line->stops + line->first;
+    const line_stop_t* current = begin + line->num_stops;
+
+    if (current != begin)
+        output_string(out, stop_table.names[(--current)->stop]);
+    while (current != begin) {
+        output_bytes(out, ", ", 2);
+        output_string(out, stop_table.names[(--current)->stop]);
+    }
+    output_char(out, '\n');
+}
+
+/*
+ * gives the line a dense id, reusing the ones of removed lines first.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int register_line(line_t* line) {
+    line_t** ids;
+    unsigned int* free_ids;
+    unsigned int capacity;
+
+    if (num_free_line_ids) {
+        line->id = free_line_ids[--num_free_line_ids];
+        line_ids[line->id] = line;
+        return 0;
+    }
+
+    if (num_line_ids == line_ids_capacity) {
+        capacity = (line_ids_capacity) ? line_ids_capacity * 2 : 16;
+        if (!(ids = realloc(line_ids, sizeof(line_t*) * capacity)))
+            return -1;
+        line_ids = ids;
+        if (!(free_ids = realloc(free_line_ids,
+                                 sizeof(unsigned int) * capacity)))
+            return -1;
+        free_line_ids = free_ids;
+        line_ids_capacity = capacity;
+    }
+    line->id = num_line_ids++;
+    line_ids[line->id] = line;
+    return 0;
+}
+
+/*
+ * gives back the id of a removed line.
+ */
+void unregister_line(line_t* line) {
+    line_ids[line->id] = NULL;
+    free_line_ids[num_free_line_ids++] = line->id;
+}
+
+/*
+ * returns the position of the line with the given name in the stop's sorted
+ * lines, or the one it should take.
+ */
+unsigned int line_name_position(unsigned int stop, const char* name) {
+    const stop_t* record = stop_table.records + stop;
+    unsigned int low = 0, high = stop_table.num_lines[stop], middle;
+    if (record->unsorted) {
+        while (low < high &&
+               strcmp(line_ids[record->sorted_lines[low]]->name, name))
+            low++;
+        return low;
+    }
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (strcmp(line_ids[record->sorted_lines[middle]]->name, name) < 0)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/*
+ * remembers that the stop's lines have to be sorted when the bulk load ends.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int mark_unsorted(unsigned int stop) {
+    unsigned int* new;
+    unsigned int capacity;
+
+    if (num_unsorted_stops == unsorted_stops_capacity) {
+        capacity = (unsorted_stops_capacity) ? unsorted_stops_capacity * 2 : 16;
+        if (!(new = realloc(unsorted_stops, sizeof(unsigned int) * capacity)))
+            return -1;
+        unsorted_stops = new;
+        unsorted_stops_capacity = capacity;
+    }
+    unsorted_stops[num_unsorted_stops++] = stop;
+    stop_table.records[stop].unsorted = 1;
+    return 0;
+}
+
+/*
+ * adds a new line of the stop to its sorted lines, keeping them in order
+ * (unless in the middle of a bulk load).
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int add_line_name(unsigned int stop, line_t* line) {
+    stop_t* record = stop_table.records + stop;
+    unsigned int i, capacity, num_lines = stop_table.num_lines[stop];
+    unsigned int* sorted;
+
+    if (num_lines == record->sorted_lines_capacity) {
+        capacity = (num_lines) ? num_lines * 2 : 2;
+        if (!(sorted =
+                  sizepool_alloc(&blocks, sizeof(unsigned int) * capacity)))
+            return -1;
+        if (record->sorted_lines)
+            memcpy(sorted, record->sorted_lines,
+                   sizeof(unsigned int) * num_lines);
+        sizepool_free(&blocks, record->sorted_lines,
+                      sizeof(unsigned int) * record->sorted_lines_capacity);
+        record->sorted_lines = sorted;
+        record->sorted_lines_capacity = capacity;
+    }
+
+    if (deferring) {
+        /* sorted once, when the bulk load ends */
+        if (!record->unsorted && mark_unsorted(stop))
+            return -1;
+        record->sorted_lines[num_lines] = line->id;
+        return 0;
+    }
+
+    i = line_name_position(stop, line->name);
+    memmove(record->sorted_lines + i + 1, record->sorted_lines + i,
+            sizeof(unsigned int) * (num_lines - i));
+    record->sorted_lines[i] = line->id;
+    return 0;
+}
+
+/*
+ * removes a line the stop no longer has from its sorted lines.
+ */
+void remove_line_name(unsigned int stop, line_t* line) {
+    stop_t* record = stop_table.records + stop;
+    unsigned int i = line_name_position(stop, line->name);
+    memmove(record->sorted_lines + i, record->sorted_lines + i + 1,
+            sizeof(unsigned int) * (stop_table.num_lines[stop] - i - 1));
+}
 
-    if (current) {
-        printf("%s", current->raw->name);
-        current = current->prev;
+/*
+ * when the stop was added, for the order of the interchanges (and of the stops
+ * found by the g command).
+ */
+__always_inline unsigned long stop_order(unsigned int stop) {
+    return stop_table.records[stop].order;
+}
+
+/*
+ * returns the position of the given stop in the interchanges, or the one it
+ * should take.
+ */
+unsigned int interchange_position(unsigned int stop) {
+    unsigned int low = 0, high = num_interchanges, middle;
+    if (interchanges_unsorted) {
+        while (low < high && interchanges[low] != stop)
+            low++;
+        return low;
+    }
+    while (low < high) {
+        middle = low + (high - low) / 2;
+        if (stop_order(interchanges[middle]) < stop_order(stop))
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/*
+ * sorts the lines (by name) with a (bottom-up) merge sort, using tmp as
+ * scratch space.
+ * without it (no memory), they are sorted in place by insertion.
+ */
+void sort_line_names(unsigned int* sorted, unsigned int* tmp,
+                     unsigned int size) {
+    unsigned int width, low, middle, high, i, j, k, line;
+    unsigned int* swap;
+    unsigned int* from = sorted;
+    unsigned int* to = tmp;
+
+    if (!tmp) {
+        for (i = 1; i < size; i++) {
+            for (line = sorted[i], j = i;
+                 j && strcmp(line_ids[sorted[j - 1]]->name,
+                             line_ids[line]->name) > 0;
+                 j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = line;
+        }
+        return;
     }
-    while (current) {
-        printf(", %s", current->raw->name);
-        current = current->prev;
+
+    for (width = 1; width < size; width *= 2) {
+        for (low = 0; low < size; low += 2 * width) {
+            middle = (low + width < size) ? low + width : size;
+            high = (middle + width < size) ? middle + width : size;
+            for (i = low, j = middle, k = low; k < high; k++)
+                to[k] = (j >= high || (i < middle &&
+                                       strcmp(line_ids[from[i]]->name,
+                                              line_ids[from[j]]->name) <= 0))
+                            ? from[i++]
+                            : from[j++];
+        }
+        swap = from;
+        from = to;
+        to = swap;
     }
-    printf("\n");
+    if (from != sorted)
+        memcpy(sorted, from, sizeof(unsigned int) * size);
 }
 
 /*
- * destroys (deletes and frees) the info stored in the dll of a line.
+ * sorts the stops by the order they were added, with a (bottom-up) merge
+ * sort, using tmp as scratch space.
+ * without it (no memory), they are sorted in place by insertion.
  */
-void stop_dll_destroy(stop_node_t* origin) {
-    if (!origin)
+void sort_stops(unsigned int* sorted, unsigned int* tmp, unsigned int size) {
+    unsigned int width, low, middle, high, i, j, k;
+    unsigned int stop, *swap;
+    unsigned int* from = sorted;
+    unsigned int* to = tmp;
+
+    if (!tmp) {
+        for (i = 1; i < size; i++) {
+            for (stop = sorted[i], j = i;
+                 j && stop_order(sorted[j - 1]) > stop_order(stop); j--)
+                sorted[j] = sorted[j - 1];
+            sorted[j] = stop;
+        }
         return;
-    stop_dll_destroy(origin->next);
-    free(origin);
+    }
+
+    for (width = 1; width < size; width *= 2) {
+        for (low = 0; low < size; low += 2 * width) {
+            middle = (low + width < size) ? low + width : size;
+            high = (middle + width < size) ? middle + width : size;
+            for (i = low, j = middle, k = low; k < high; k++)
+                to[k] = (j >= high || (i < middle && stop_order(from[i]) <=
+                                                         stop_order(from[j])))
+                            ? from[i++]
+                            : from[j++];
+        }
+        swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != sorted)
+        memcpy(sorted, from, sizeof(unsigned int) * size);
+}
+
+/*
+ * registers a stop that now has more than one line.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int add_interchange(unsigned int stop) {
+    unsigned int i, capacity;
+    unsigned int* new;
+
+    if (num_interchanges == interchanges_capacity) {
+        capacity = (interchanges_capacity) ? interchanges_capacity * 2 : 16;
+        if (!(new = realloc(interchanges, sizeof(unsigned int) * capacity)))
+            return -1;
+        interchanges = new;
+        interchanges_capacity = capacity;
+    }
+
+    if (deferring) {
+        /* sorted once, when the bulk load ends */
+        interchanges_unsorted = 1;
+        i = num_interchanges;
+    } else
+        i = interchange_position(stop);
+    memmove(interchanges + i + 1, interchanges + i,
+            sizeof(unsigned int) * (num_interchanges - i));
+    interchanges[i] = stop;
+    num_interchanges++;
+    return 0;
+}
+
+/*
+ * unregisters a stop that no longer has more than one line.
+ */
+void remove_interchange(unsigned int stop) {
+    unsigned int i = interchange_position(stop);
+    memmove(interchanges + i, interchanges + i + 1,
+            sizeof(unsigned int) * (num_interchanges - i - 1));
+    num_interchanges--;
+}
+
+/*
+ * the stop gets a new line, which may make it an interchange.
+ * returns 0 if ok, -1 if there wasn't memory for it (and nothing changes).
+ */
+int stop_gained_line(unsigned int stop, line_t* line) {
+    if (add_line_name(stop, line))
+        return -1;
+    if (++stop_table.num_lines[stop] == 2 && add_interchange(stop)) {
+        remove_line_name(stop, line);
+        stop_table.num_lines[stop]--;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * the stop no longer has the given line.
+ */
+void stop_lost_line(unsigned int stop, line_t* line) {
+    remove_line_name(stop, line);
+    if (stop_table.num_lines[stop]-- == 2)
+        remove_interchange(stop);
+}
+
+/*
+ * the stop is added to the given line: the line becomes one of the stop's
+ * lines (if it wasn't already).
+ * returns 0 if ok, -1 if there wasn't memory for it (and nothing changes).
+ */
+int stop_joined_line(unsigned int stop, line_t* line) {
+    line_set_t* set = &stop_table.records[stop].lines;
+    int added;
+    if ((added = line_set_add(set, &blocks, line->id)) < 0)
+        return -1;
+    if (added && stop_gained_line(stop, line)) {
+        line_set_remove(set, &blocks, line->id);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * the stop is taken out of the given line once: when it is no longer in the
+ * line at all, the stop loses the line.
+ */
+void stop_left_line(unsigned int stop, line_t* line) {
+    if (line_set_remove(&stop_table.records[stop].lines, &blocks, line->id))
+        stop_lost_line(stop, line);
+}
+
+/*
+ * makes room for another stop at the origin (or destination) of the line.
+ * the route is moved back to the middle of its array, which doubles when it
+ * is more than half full, so stops are added to either end in amortized
+ * constant time.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int line_reserve(line_t* line, int at_origin) {
+    unsigned int capacity = line->capacity, size = line->num_stops;
+    line_stop_t* stops;
+
+    if ((at_origin) ? line->first > 0 : line->first + size < capacity)
+        return 0;
+
+    if (size + 1 > capacity / 2) {
+        capacity = (capacity) ? capacity * 2 : LINE_FIRST_CAPACITY;
+        if (!(stops = sizepool_alloc(&blocks, sizeof(line_stop_t) * capacity)))
+            return -1;
+        if (size)
+            memcpy(stops + (capacity - size) / 2, line->stops + line->first,
+                   sizeof(line_stop_t) * size);
+        if (line->stops)
+            sizepool_free(&blocks, line->stops,
+                          sizeof(line_stop_t) * line->capacity);
+        line->stops = stops;
+        line->capacity = capacity;
+    } else
+        memmove(line->stops + (capacity - size) / 2, line->stops + line->first,
+                sizeof(line_stop_t) * size);
+    line->first = (capacity - size) / 2;
+    return 0;
+}
+
+/*
+ * adds a stop to the origin (or destination) of the line, arriving by a link
+ * of the given cost and duration.
+ * returns 0 if ok, -1 if there wasn't memory for it (and nothing changes).
+ */
+int line_add_stop(line_t* line, unsigned int stop, int at_origin, double cost,
+                  double duration) {
+    line_stop_t* new;
+
+    if (line_reserve(line, at_origin) || stop_joined_line(stop, line))
+        return -1;
+    if (at_origin)
+        new = line->stops + --line->first;
+    else
+        new = line->stops + line->first + line->num_stops;
+    new->stop = stop;
+    new->cost = cost;
+    new->duration = duration;
+    line->num_stops++;
+    return 0;
+}
+
+/*
+ * takes every stop out of the line, and gives its route back.
+ */
+void line_clear(line_t* line) {
+    const line_stop_t* current = line->stops + line->first;
+    const line_stop_t* end = current + line->num_stops;
+
+    for (; current < end; current++)
+        stop_left_line(current->stop, line);
+    if (line->stops)
+        sizepool_free(&blocks, line->stops,
+                      sizeof(line_stop_t) * line->capacity);
+    line->stops = NULL;
+    line->first = line->capacity = 0;
+    line->num_stops = 0;
 }
 
 /*
  * adds a new line to the system.
  * in case of errors, a message will be printed to stdin to inform the user.
  */
-void add_new_line(const char* name) {
+void add_new_line(output_t* out, const char* name, size_t hash) {
     line_t* new;
-    if (!(new = (line_t*)malloc(sizeof(line_t)))) {
-        printf("couldn't get memory for the new line!\n");
+    if (!(new = (line_t*)pool_alloc(&line_pool))) {
+        output_string(out, "couldn't get memory for the new line!\n");
         fprintf(stderr, "maybe this should panic instead\n");
         return;
     }
 
-    if (!(new->name = malloc(sizeof(char) * (strlen(name) + 1)))) {
-        printf("couldn't get memory for the new line!\n");
+    if (!(new->name = sizepool_strdup(&blocks, name))) {
+        pool_free(&line_pool, new);
+        output_string(out, "couldn't get memory for the new line!\n");
+        fprintf(stderr, "maybe this should panic instead\n");
+        return;
+    }
+
+    if (register_line(new)) {
+        sizepool_strfree(&blocks, new->name);
+        pool_free(&line_pool, new);
+        output_string(out, "couldn't get memory for the new line!\n");
         fprintf(stderr, "maybe this should panic instead\n");
         return;
     }
 
     /* add the values to the new line */
-    strcpy(new->name, name);
-    new->origin = NULL;
-    new->destination = NULL;
+    new->stops = NULL;
+    new->first = new->capacity = 0;
     new->num_stops = 0;
     new->total_cost = 0;
     new->total_duration = 0;
-    lht_insert_entry(lines, new->name, new);
+    lht_insert_entry_hashed(lines, new->name, hash, new);
 }
 
 /*
@@ -148,118 +632,129 @@ void add_new_line(const char* name) {
  * Adds a line to the system if one with the given name doesn't exist yet
  * Else, prints all the stops in the line.
  */
-void list_or_add_line(char* str) {
+void list_or_add_line(output_t* out, char* str) {
     char* token;
     line_t* line;
+    size_t hash, length;
 
-    if (!(token = strtok(str, DELIMITERS))) {
-        list_all_lines();
+    if (!(token = input_word(&str, &length))) {
+        list_all_lines(out);
         return;
     }
 
     /* if the line already exists */
-    if ((line = get_line(token))) {
+    if ((line = get_line_hashed(token, hash = hash_bytes(token, length)))) {
         /* there is no sorting request */
-        if (!(token = strtok(NULL, DELIMITERS))) {
-            list_single_line(line);
+        if (!(token = input_word(&str, &length))) {
+            list_single_line(out, line);
             return;
         }
         /* in case there is, we have to verify its validity */
-        if (!strncmp(token, INVERT, strlen(token))) {
-            list_single_line_inverted(line);
+        if (!strncmp(token, INVERT, length)) {
+            list_single_line_inverted(out, line);
             return;
         }
-        printf("incorrect sort option.\n");
+        output_string(out, "incorrect sort option.\n");
         return;
     }
 
     /* else add it */
-    add_new_line(token);
-}
-
-/*
- * removes the given line from the given stop, if it has it.
- */
-void remove_line_from_stop(line_t* line, stop_t* stop) {
-    line_node_t* current;
-    current = stop->head_lines;
-    while (current) {
-        if (current->raw == line) {
-            /* in case it is the first element */
-            if (!current->prev)
-                stop->head_lines = current->next;
-            else
-                current->prev->next = current->next;
-
-            /* in case it is the last element */
-            if (!current->next)
-                stop->tail_lines = current->prev;
-            else
-                current->next->prev = current->prev;
-
-            stop->num_lines--;
-            free(current);
-            return;
-        }
-        current = current->next;
-    }
+    add_new_line(out, token, hash);
 }
 
 /*
- * passes by all the stops and removes the given line from it, if it has it.
+ * gives back the name of a line or stop just removed. the listings the readers
+ * have yet to print may still use it, in which case it is only retired.
  */
-void remove_line_from_all_stops(line_t* line) {
-    stop_t* current = lht_iter(stops, BEGIN);
-    while (current) {
-        remove_line_from_stop(line, current);
-        current = lht_iter(stops, KEEP);
-    }
+void release_name(char* name) {
+    if (readers.num_threads)
+        readers_retire(&readers, name);
+    else
+        sizepool_strfree(&blocks, name);
 }
 
 /*
  * r command.
  * removes a line from the system.
  */
-void remove_line(char* str) {
+void remove_line(output_t* out, char* str) {
     line_t* line;
-    char* name = strtok(str, DELIMITERS);
+    size_t length;
+    char* name = input_word(&str, &length);
 
-    if (!(line = (line_t*)lht_leak_entry(lines, name))) {
-        printf("%s: no such line.\n", name);
+    if (!name)
+        return;
+    if (!(line = (line_t*)lht_leak_entry_hashed(lines, name,
+                                                hash_bytes(name, length)))) {
+        output_string(out, name);
+        output_string(out, ": no such line.\n");
         return;
     }
 
-    /* remove all the stops from the line */
-    stop_dll_destroy(line->origin);
+    /* remove all the stops from the line (and the line from them) */
+    line_clear(line);
+    route_invalidate(&routes);
 
-    remove_line_from_all_stops(line);
+    unregister_line(line);
+    release_name(line->name);
+    pool_free(&line_pool, line);
+}
 
-    free(line->name);
-    free(line);
+/*
+ * copies what the listing of all the stops prints of the stop.
+ */
+__always_inline void copy_stop(readers_stop_t* row, unsigned int stop) {
+    row->name = stop_table.names[stop];
+    row->latitude = stop_table.latitudes[stop];
+    row->longitude = stop_table.longitudes[stop];
+    row->num_lines = stop_table.num_lines[stop];
 }
 
 /*
- * lists all the stops in the system.
+ * prints the stop as the listing of all the stops does.
  */
-void list_all_stops(void) {
-    stop_t* current = lht_iter(stops, BEGIN);
-    while (current) {
-        printf("%s: %16.12f %16.12f %d\n", current->name,
-               current->locale.latitude, current->locale.longitude,
-               current->num_lines);
-        current = lht_iter(stops, KEEP);
+void print_stop(output_t* out, unsigned int stop) {
+    readers_stop_t row;
+    copy_stop(&row, stop);
+    readers_print_stop(out, &row);
+}
+
+/*
+ * lists all the stops in the system, in the order they were added.
+ */
+void list_all_stops(output_t* out) {
+    unsigned int i, stop;
+    readers_job_t* job;
+    readers_stop_t* row;
+
+    /* with readers, the stops are copied for one of them to print */
+    if (readers.num_threads &&
+        (job = readers_job('p', stop_table.num_stops, sizeof(readers_stop_t),
+                           0))) {
+        row = job->rows;
+        for (i = 0; i < stop_table.listing_size; i++)
+            if ((stop = stop_table.listing[i]) != NO_STOP)
+                copy_stop(row++, stop);
+        readers_submit(&readers, job);
+        return;
     }
+    for (i = 0; i < stop_table.listing_size; i++)
+        if ((stop = stop_table.listing[i]) != NO_STOP)
+            print_stop(out, stop);
 }
 
 /*
  * lists a single stop registered with the given name.
  * returns 0 if ok, -1 if the stop doesn't exit.
  */
-int list_single_stop(char* name) {
-    stop_t* stop;
-    if (!(stop = get_stop(name)))
+int list_single_stop(output_t* out, const char* name, size_t hash) {
+    unsigned int stop;
+    if ((stop = get_stop_hashed(name, hash)) == NO_STOP)
         return -1;
-    printf("%16.12f %16.12f\n", stop->locale.latitude, stop->locale.longitude);
+    output_fixed(out, stop_table.latitudes[stop], 16, 12);
+    output_char(out, ' ');
+    output_fixed(out, stop_table.longitudes[stop], 16, 12);
+    output_char(out, '\n');
     return 0;
 }
 
@@ -267,215 +762,190 @@ int list_single_stop(char* name) {
  * registers a new stop.
  * returns 0 if all went well, -1 otherwise.
  */
-int add_new_stop(const char* name, const double latitude,
-                 const double longitude) {
-    stop_t* new;
-    if (get_stop(name))
+int add_new_stop(output_t* out, const char* name, size_t hash,
+                 const double latitude, const double longitude) {
+    unsigned int new;
+    char* copy;
+    if (get_stop_hashed(name, hash) != NO_STOP)
         return -1;
 
-    if (!(new = malloc(sizeof(stop_t)))) {
-        printf("couldn't get memory for the new stop!\n");
+    if (!(copy = sizepool_strdup(&blocks, name))) {
+        output_string(out, "couldn't get memory for the new stop's name!\n");
         fprintf(stderr, "maybe this should panic instead\n");
         return 0;
     }
 
-    if (!(new->name = malloc(sizeof(char) * (strlen(name) + 1)))) {
-        free(new);
-        printf("couldn't get memory for the new stop's name!\n");
+    if ((new = stop_table_add(&stop_table, copy, latitude, longitude)) ==
+        NO_STOP) {
+        sizepool_strfree(&blocks, copy);
+        output_string(out, "couldn't get memory for the new stop!\n");
         fprintf(stderr, "maybe this should panic instead\n");
         return 0;
     }
+    if (spatial_add(&spatial, new, latitude, longitude)) {
+        stop_table_remove(&stop_table, new);
+        sizepool_strfree(&blocks, copy);
+        output_string(out, "couldn't get memory for the new stop!\n");
+        fprintf(stderr, "maybe this should panic instead\n");
+        return 0;
+    }
+    stop_table.records[new].order = num_stops_added++;
 
-    /* adds values to the new stop */
-    strcpy(new->name, name);
-    new->locale.latitude = latitude;
-    new->locale.longitude = longitude;
-    new->num_lines = 0;
-    new->head_lines = NULL;
-
-    lht_insert_entry(stops, new->name, new);
+    lht_insert_entry_hashed(stops, copy, hash, stop_entry(new));
     return 0;
 }
 
 /*
  * p command.
  * receives a string which corresponds to the arguments of the command.
- * parsed with strtok (destructive).
+ * parsed in place (destructive).
  */
-void list_or_add_stop(char* str) {
-    char* token;
-    char* name;
+void list_or_add_stop(output_t* out, char* str) {
+    char *name, *latitude, *longitude;
+    size_t hash, length;
 
-    /*
-     * a trick to handle both cases with strtok without branching the code
-     * completely.
-     * if there isn't " in the input, the first " token is the whole input, and
-     * the second will be NULL. In this case, we still have to check if the NULL
-     * means there is no arguments or if there is ".
-     */
-    strtok(str, "\"");
-    if (!(name = strtok(NULL, "\""))) {
-        if (!(name = strtok(str, DELIMITERS))) {
-            list_all_stops();
-            return;
-        }
+    if (!(name = input_name(&str, &length))) {
+        list_all_stops(out);
+        return;
     }
+    hash = hash_bytes(name, length);
 
-    if (!(token = strtok(NULL, DELIMITERS))) {
-        if (list_single_stop(name))
-            printf("%s: no such stop.\n", name);
+    if (!(latitude = input_word(&str, NULL))) {
+        if (list_single_stop(out, name, hash)) {
+            output_string(out, name);
+            output_string(out, ": no such stop.\n");
+        }
         return;
     }
+    if (!(longitude = input_word(&str, NULL)))
+        return;
 
-    if (add_new_stop(name, atof(token), atof(strtok(NULL, DELIMITERS))))
-        printf("%s: stop already exists.\n", name);
+    if (add_new_stop(out, name, hash, input_number(latitude),
+                     input_number(longitude))) {
+        output_string(out, name);
+        output_string(out, ": stop already exists.\n");
+    }
 }
 
 /*
- * parses the input of the c command.
+ * parses the input of the l command, in place.
+ * returns 0 if ok, -1 if some argument is missing.
  */
-void get_c_input(const char* input, char* line_name, char* origin_name,
-                 char* destination_name, double* cost, double* duration) {
-    int ss_count = sscanf(input, "%s \"%[^\"]\" \"%[^\"]\" %lf %lf", line_name,
-                          origin_name, destination_name, cost, duration);
-
-    if (ss_count != 5)
-        ss_count = sscanf(input, "%s \"%[^\"]\" %s %lf %lf", line_name,
-                          origin_name, destination_name, cost, duration);
-    if (ss_count != 5)
-        ss_count = sscanf(input, "%s %s \"%[^\"]\" %lf %lf", line_name,
-                          origin_name, destination_name, cost, duration);
-    if (ss_count != 5)
-        sscanf(input, "%s %s %s %lf %lf", line_name, origin_name,
-               destination_name, cost, duration);
+int get_l_input(char* input, char** line_name, size_t* line_length,
+                char** origin_name, size_t* origin_length,
+                char** destination_name, size_t* destination_length,
+                double* cost, double* duration) {
+    char *cost_token, *duration_token;
+
+    if (!(*line_name = input_word(&input, line_length)) ||
+        !(*origin_name = input_name(&input, origin_length)) ||
+        !(*destination_name = input_name(&input, destination_length)) ||
+        !(cost_token = input_word(&input, NULL)) ||
+        !(duration_token = input_word(&input, NULL)))
+        return -1;
+    *cost = input_number(cost_token);
+    *duration = input_number(duration_token);
+    return 0;
 }
 
 /*
- * removes a stop from a line.
- * implies removing it from the linked list of stops and freeing the memory for
- * the ll node.
- * (there must be a smarter way of doing this...)
+ * removes every occurrence of the given stop from the line, in a single pass
+ * that packs the stops left:
+ * - at the start of the line, the link leaving each removed stop is dropped
+ *   (its cost and duration come off the totals);
+ * - in the middle, the link arriving at each removed stop is merged into the
+ *   one leaving it, from the first of each run on;
+ * - at the end, the link arriving at each removed stop is dropped, from the
+ *   last one back.
+ * the totals change in the same order as when the ends were taken first.
  */
-void unlink_stop(line_t* line, stop_t* stop) {
-    stop_node_t *current, *tmp;
-    if (!line->origin || !line->destination)
-        return;
-    if (stop == line->origin->raw) {
-        if ((current = line->origin->next)) {
-            line->total_cost -= current->cost;
-            line->total_duration -= current->duration;
-            current->cost = 0;
-            current->duration = 0;
-            current->prev = NULL;
+void unlink_stop_from_line(line_t* line, unsigned int stop) {
+    line_stop_t* current = line->stops + line->first;
+    line_stop_t* end = current + line->num_stops;
+    line_stop_t *kept, *run_start = NULL;
+    double cost = 0, duration = 0;
+    int run = 0;
+
+    STATS_ADD(STATS_NODE_VISITS, line->num_stops);
+    for (; current < end && current->stop == stop; current++)
+        if (current + 1 < end) {
+            line->total_cost -= current[1].cost;
+            line->total_duration -= current[1].duration;
+            current[1].cost = 0;
+            current[1].duration = 0;
         }
-        free(line->origin);
-        line->origin = current;
-        line->num_stops--;
-        unlink_stop(line, stop);
-        return;
-    }
-    if (stop == line->destination->raw) {
-        current = line->destination->prev;
-        line->total_cost -= line->destination->cost;
-        line->total_duration -= line->destination->duration;
-        free(line->destination);
-        current->next = NULL;
-        line->destination = current;
-        line->num_stops--;
-        unlink_stop(line, stop);
-        return;
-    }
-
-    current = line->origin;
-    while (current) {
-        tmp = current->next;
-        if (current->raw == stop) {
-            current->next->cost += current->cost;
-            current->next->duration += current->duration;
-            current->next->prev = current->prev;
-            current->prev->next = current->next;
-            current->raw->num_lines--;
-            free(current);
-            line->num_stops--;
-            unlink_stop(line, stop);
-            return;
+    line->first = current - line->stops;
+
+    for (kept = current; current < end; current++) {
+        if (current->stop == stop) {
+            if (!run)
+                run_start = current;
+            cost = (run) ? current->cost + cost : current->cost;
+            duration = (run) ? current->duration + duration : current->duration;
+            run = 1;
+            continue;
         }
-        current = tmp;
+        *kept = *current;
+        if (run) {
+            kept->cost += cost;
+            kept->duration += duration;
+            run = 0;
+        }
+        kept++;
     }
+    /* a run left at the end of the line (not overwritten by the packing) */
+    if (run)
+        for (current = end; current > run_start; current--) {
+            line->total_cost -= current[-1].cost;
+            line->total_duration -= current[-1].duration;
+        }
+    line->num_stops = kept - (line->stops + line->first);
 }
 
 /*
- * destroys (deletes and frees) the info stored in the dll of a stop.
+ * removes a stop from all the lines it is in.
  */
-void line_dll_destroy(line_node_t* origin) {
-    if (!origin)
-        return;
-    line_dll_destroy(origin->next);
-    free(origin);
+void unlink_stop(unsigned int stop) {
+    const line_set_t* set = &stop_table.records[stop].lines;
+    unsigned int i;
+
+    STATS_ADD(STATS_UNLINKS, 1);
+    for (i = 0; i < set->size; i++)
+        unlink_stop_from_line(line_ids[set->items[i].id], stop);
 }
 
 /*
  * e command.
  * removes a stop from the system.
  */
-void remove_stop(char* str) {
-    char name[MAX_INPUT];
-    stop_t* stop;
-    line_t* current;
-
-    if (!sscanf(str, " \"%[^\"]\"", name))
-        sscanf(str, " %s", name);
+void remove_stop(output_t* out, char* str) {
+    char* name;
+    size_t length;
+    unsigned int stop;
+    stop_t* record;
 
-    if (!(stop = lht_leak_entry(stops, name))) {
-        printf("%s: no such stop.\n", name);
+    if (!(name = input_name(&str, &length)))
         return;
-    }
-
-    current = lht_iter(lines, BEGIN);
 
-    while (current) {
-        unlink_stop(current, stop);
-        current = lht_iter(lines, KEEP);
-    }
-
-    line_dll_destroy(stop->head_lines);
-    free(stop->name);
-    free(stop);
-}
-
-/*
- * adds a pointer to a line to a stop.
- * means the line passes by this stop.
- */
-void add_line_to_stop(line_t* line, stop_t* stop) {
-    line_node_t* current;
-    if (!(current = stop->head_lines)) {
-        if (!(stop->head_lines = malloc(sizeof(line_node_t)))) {
-            printf("no memory.\n");
-            return;
-        }
-        stop->head_lines->raw = line;
-        stop->head_lines->next = NULL;
-        stop->head_lines->prev = NULL;
-        stop->num_lines++;
+    if ((stop = entry_stop(lht_leak_entry_hashed(
+             stops, name, hash_bytes(name, length)))) == NO_STOP) {
+        output_string(out, name);
+        output_string(out, ": no such stop.\n");
         return;
     }
-    while (1) {
-        if (current->raw == line)
-            return;
-        if (!current->next) {
-            if (!(current->next = malloc(sizeof(line_node_t)))) {
-                printf("no memory.\n");
-                return;
-            }
-            current->next->raw = line;
-            current->next->next = NULL;
-            current->next->prev = current;
-            stop->num_lines++;
-            return;
-        }
-        current = current->next;
-    }
+
+    unlink_stop(stop);
+    route_invalidate(&routes);
+
+    if (stop_table.num_lines[stop] > 1)
+        remove_interchange(stop);
+    record = stop_table.records + stop;
+    line_set_clear(&record->lines, &blocks);
+    sizepool_free(&blocks, record->sorted_lines,
+                  sizeof(unsigned int) * record->sorted_lines_capacity);
+    release_name(stop_table.names[stop]);
+    spatial_remove(&spatial, stop);
+    stop_table_remove(&stop_table, stop);
 }
 
 /*
@@ -483,200 +953,822 @@ void add_line_to_stop(line_t* line, stop_t* stop) {
  * adds a stop (or two in case they are the first) to a line.
  * receives a string with the arguments of the command.
  */
-void add_connection(char* str) {
-    char line_name[MAX_INPUT];
-    char origin_name[MAX_INPUT];
-    char destination_name[MAX_INPUT];
+void add_connection(output_t* out, char* str) {
+    char *line_name, *origin_name, *destination_name;
+    size_t line_length, origin_length, destination_length;
     double cost, duration;
-    stop_t *origin, *destination;
+    unsigned int origin, destination;
     line_t* line;
-    stop_node_t* tmp;
+    line_stop_t* first;
 
-    get_c_input(str, line_name, origin_name, destination_name, &cost,
-                &duration);
+    if (get_l_input(str, &line_name, &line_length, &origin_name, &origin_length,
+                    &destination_name, &destination_length, &cost, &duration))
+        return;
 
-    if (!(line = get_line(line_name))) {
-        printf("%s: no such line.\n", line_name);
+    if (!(line = get_line_hashed(line_name,
+                                 hash_bytes(line_name, line_length)))) {
+        output_string(out, line_name);
+        output_string(out, ": no such line.\n");
         return;
     }
 
-    if (!(origin = get_stop(origin_name))) {
-        printf("%s: no such stop.\n", origin_name);
+    if ((origin = get_stop_hashed(origin_name, hash_bytes(origin_name,
+                                                          origin_length))) ==
+        NO_STOP) {
+        output_string(out, origin_name);
+        output_string(out, ": no such stop.\n");
         return;
     }
 
-    if (!(destination = get_stop(destination_name))) {
-        printf("%s: no such stop.\n", destination_name);
+    if ((destination = get_stop_hashed(
+             destination_name,
+             hash_bytes(destination_name, destination_length))) == NO_STOP) {
+        output_string(out, destination_name);
+        output_string(out, ": no such stop.\n");
         return;
     }
 
     if (cost < 0 || duration < 0) {
-        printf("negative cost or duration.\n");
+        output_string(out, "negative cost or duration.\n");
         return;
     }
 
-    /*
-     * not happy with the following code... at all!
-     * but probably there is no other way of doing stupid code like this...
-     */
-    if (!line->origin && !line->destination) {
-        line->origin = (stop_node_t*)malloc(sizeof(stop_node_t));
-        line->destination = (stop_node_t*)malloc(sizeof(stop_node_t));
-        if (!line->origin || !line->destination) {
-            if (line->origin)
-                free(line->origin);
-            if (line->destination)
-                free(line->destination);
-            printf("couldn't get memory for the new stop node!\n");
+    if (!line->num_stops) {
+        if (line_add_stop(line, origin, 0, 0, 0)) {
+            output_string(out, "couldn't get memory for the new stop node!\n");
+            fprintf(stderr, "maybe this should panic instead\n");
+            return;
+        }
+        if (line_add_stop(line, destination, 0, cost, duration)) {
+            line_clear(line);
+            output_string(out, "couldn't get memory for the new stop node!\n");
             fprintf(stderr, "maybe this should panic instead\n");
             return;
         }
-        line->origin->next = line->destination;
-        line->origin->prev = NULL;
-        line->destination->prev = line->origin;
-        line->destination->next = NULL;
-
-        line->origin->raw = origin;
-        line->origin->cost = line->origin->duration = 0;
-
-        line->destination->raw = destination;
-        line->destination->cost = cost;
-        line->destination->duration = duration;
-
         line->total_cost += cost;
         line->total_duration += duration;
-        line->num_stops = 2;
-        add_line_to_stop(line, origin);
-        add_line_to_stop(line, destination);
+        route_invalidate(&routes);
         return;
     }
 
-    if (line->origin->raw != destination && line->destination->raw != origin) {
-        printf("link cannot be associated with bus line.\n");
+    first = line->stops + line->first;
+    if (first->stop != destination &&
+        first[line->num_stops - 1].stop != origin) {
+        output_string(out, "link cannot be associated with bus line.\n");
         return;
     }
 
-    if (line->destination->raw == origin) {
-        tmp = (stop_node_t*)malloc(sizeof(stop_node_t));
-        if (!tmp) {
-            printf("couldn't get memory for the new stop node!\n");
+    if (first[line->num_stops - 1].stop == origin) {
+        if (line_add_stop(line, destination, 0, cost, duration)) {
+            output_string(out, "couldn't get memory for the new stop node!\n");
             fprintf(stderr, "maybe this should panic instead\n");
             return;
         }
-        tmp->prev = line->destination;
-        tmp->next = NULL;
-        tmp->raw = destination;
-        tmp->cost = cost;
-        tmp->duration = duration;
-        line->destination->next = tmp;
-        line->destination = tmp;
-        add_line_to_stop(line, destination);
     } else {
-        tmp = (stop_node_t*)malloc(sizeof(stop_node_t));
-        if (!tmp) {
-            printf("couldn't get memory for the new stop node!\n");
+        if (line_add_stop(line, origin, 1, 0, 0)) {
+            output_string(out, "couldn't get memory for the new stop node!\n");
             fprintf(stderr, "maybe this should panic instead\n");
             return;
         }
-        tmp->next = line->origin;
-        tmp->prev = NULL;
-        tmp->raw = origin;
-        tmp->cost = tmp->duration = 0;
-        line->origin->cost = cost;
-        line->origin->duration = duration;
-        line->origin->prev = tmp;
-        line->origin = tmp;
-        add_line_to_stop(line, origin);
+        /* the old origin now arrives from the new one */
+        line->stops[line->first + 1].cost = cost;
+        line->stops[line->first + 1].duration = duration;
     }
 
-    line->num_stops++;
     line->total_cost += cost;
     line->total_duration += duration;
+    route_invalidate(&routes);
 }
 
 /*
  * a single step of the i command.
  */
-void print_intersction(const stop_t* intersection) {
+void print_intersction(output_t* out, unsigned int intersection) {
+    const unsigned int* sorted = stop_table.records[intersection].sorted_lines;
     int i;
-    line_node_t* current = intersection->head_lines;
-    int buffer_counter = 0;
-    char** buffer = (char**)malloc(sizeof(char*) * lht_get_size(lines));
-    if (!buffer) {
-        printf("couldn't get memory for the string array (sorting)!\n");
-        fprintf(stderr, "maybe this should panic instead\n");
-        return;
-    }
-
-    printf("%s %d:", intersection->name, intersection->num_lines);
 
-    while (current) {
-        buffer[buffer_counter++] = current->raw->name;
-        current = current->next;
+    output_string(out, stop_table.names[intersection]);
+    output_char(out, ' ');
+    output_int(out, stop_table.num_lines[intersection]);
+    output_char(out, ':');
+    for (i = 0; i < stop_table.num_lines[intersection]; i++) {
+        output_char(out, ' ');
+        output_string(out, line_ids[sorted[i]]->name);
     }
-    sort(buffer, buffer_counter);
-
-    for (i = 0; i < buffer_counter; i++)
-        printf(" %s", buffer[i]);
+    output_char(out, '\n');
+}
 
-    printf("\n");
-    free(buffer);
+/*
+ * hands the interchanges (and the names of their lines) to the readers.
+ * returns 0 if ok, -1 if there wasn't memory for the copy.
+ */
+int copy_interconnections(unsigned int num_names) {
+    readers_job_t* job;
+    readers_interchange_t* row;
+    const char** names;
+    const unsigned int* sorted;
+    unsigned int i, stop;
+    int j;
+
+    if (!(job = readers_job('i', num_interchanges,
+                            sizeof(readers_interchange_t), num_names)))
+        return -1;
+    row = job->rows;
+    names = job->names;
+    for (i = 0; i < num_interchanges; i++, row++) {
+        stop = interchanges[i];
+        sorted = stop_table.records[stop].sorted_lines;
+        row->name = stop_table.names[stop];
+        row->first_line = names - job->names;
+        row->num_lines = stop_table.num_lines[stop];
+        for (j = 0; j < row->num_lines; j++)
+            *names++ = line_ids[sorted[j]]->name;
+    }
+    readers_submit(&readers, job);
+    return 0;
 }
 
 /*
  * i command.
  * lists all the stops where lines intersect and those lines which intersect for
  * each stop (in alphabetic order).
+ * the interchanges (and their lines) are kept in order as the network changes,
+ * so there is nothing to look for or sort here.
  */
-void list_interconnections(char* str) {
-    stop_t* current = lht_iter(stops, BEGIN);
+void list_interconnections(output_t* out, char* str) {
+    unsigned int i, num_names = 0;
     /* there are no arguments to the i command */
     (void)str;
 
-    /* TODO: update this when iterator are created */
-    while (current) {
-        if (current->num_lines > 1)
-            print_intersction(current);
-        current = lht_iter(stops, KEEP);
+    if (readers.num_threads) {
+        for (i = 0; i < num_interchanges; i++)
+            num_names += stop_table.num_lines[interchanges[i]];
+        if (!copy_interconnections(num_names))
+            return;
+    }
+    for (i = 0; i < num_interchanges; i++)
+        print_intersction(out, interchanges[i]);
+}
+
+/*
+ * t command.
+ * prints the cheapest path between two stops, with the line taken for each
+ * leg. "duration" (or a prefix of it) looks for the quickest one instead.
+ */
+void find_route(output_t* out, char* str) {
+    char *origin_name, *destination_name, *option;
+    size_t origin_length, destination_length, length;
+    unsigned int origin, destination;
+    int by_duration = 0;
+
+    if (!(origin_name = input_name(&str, &origin_length)) ||
+        !(destination_name = input_name(&str, &destination_length)))
+        return;
+
+    if ((option = input_word(&str, &length))) {
+        if (!strncmp(option, ROUTE_BY_DURATION, length))
+            by_duration = 1;
+        else if (strncmp(option, ROUTE_BY_COST, length)) {
+            output_string(out, "incorrect route option.\n");
+            return;
+        }
+    }
+
+    if ((origin = get_stop_hashed(origin_name, hash_bytes(origin_name,
+                                                          origin_length))) ==
+        NO_STOP) {
+        output_string(out, origin_name);
+        output_string(out, ": no such stop.\n");
+        return;
+    }
+    if ((destination = get_stop_hashed(
+             destination_name,
+             hash_bytes(destination_name, destination_length))) == NO_STOP) {
+        output_string(out, destination_name);
+        output_string(out, ": no such stop.\n");
+        return;
+    }
+
+    if (route_find(&routes, &stop_table, lines, line_ids, origin, destination,
+                   by_duration, out)) {
+        route_invalidate(&routes);
+        output_string(out, "couldn't get memory for the route!\n");
+        fprintf(stderr, "maybe this should panic instead\n");
+    }
+}
+
+/*
+ * n command.
+ * lists the stops nearest to a point (one, unless a number is given), nearest
+ * first.
+ */
+void list_nearest_stops(output_t* out, char* str) {
+    char *latitude, *longitude, *count;
+    double number = 1;
+    unsigned int i;
+
+    if (!(latitude = input_word(&str, NULL)) ||
+        !(longitude = input_word(&str, NULL)))
+        return;
+    if ((count = input_word(&str, NULL)) &&
+        !((number = input_number(count)) >= 1)) {
+        output_string(out, "incorrect number of stops.\n");
+        return;
+    }
+
+    if (spatial_nearest(&spatial, &stop_table, input_number(latitude),
+                        input_number(longitude),
+                        (number < NO_STOP) ? (unsigned int)number : NO_STOP)) {
+        output_string(out, "couldn't get memory for the search!\n");
+        fprintf(stderr, "maybe this should panic instead\n");
+        return;
+    }
+    for (i = 0; i < spatial.num_found; i++)
+        print_stop(out, spatial.found[i]);
+}
+
+/*
+ * g command.
+ * lists the stops inside the box with the given corners, in the order they
+ * were added.
+ */
+void list_stops_in_box(output_t* out, char* str) {
+    char* corners[4];
+    unsigned int* tmp;
+    unsigned int i;
+
+    for (i = 0; i < 4; i++)
+        if (!(corners[i] = input_word(&str, NULL)))
+            return;
+
+    spatial_box(&spatial, input_number(corners[0]), input_number(corners[1]),
+                input_number(corners[2]), input_number(corners[3]));
+    tmp = malloc(sizeof(unsigned int) * (spatial.num_found + 1));
+    sort_stops(spatial.found, tmp, spatial.num_found);
+    free(tmp);
+    for (i = 0; i < spatial.num_found; i++)
+        print_stop(out, spatial.found[i]);
+}
+
+/*
+ * measures each leg of the line (into legs), from the locations of its stops
+ * (copied to latitudes and longitudes, to be measured all at once).
+ * returns the length of the whole line.
+ */
+double measure_line(const line_t* line, double* latitudes, double* longitudes,
+                    double* legs) {
+    const line_stop_t* route = line->stops + line->first;
+    double length = 0;
+    int i;
+
+    for (i = 0; i < line->num_stops; i++) {
+        latitudes[i] = stop_table.latitudes[route[i].stop];
+        longitudes[i] = stop_table.longitudes[route[i].stop];
+    }
+    geo_legs(latitudes, longitudes, legs, line->num_stops);
+    for (i = 0; i + 1 < line->num_stops; i++)
+        length += legs[i];
+    return length;
+}
+
+/*
+ * prints the line with its length and average speed (none if it takes no
+ * time).
+ */
+void print_line_length(output_t* out, const line_t* line, double length) {
+    output_string(out, line->name);
+    output_char(out, ' ');
+    output_fixed(out, length, 0, 2);
+    output_char(out, ' ');
+    output_fixed(out,
+                 (line->total_duration > 0) ? length / line->total_duration
+                                            : 0,
+                 0, 2);
+    output_char(out, '\n');
+}
+
+/*
+ * d command.
+ * prints the length (in kilometers) and average speed of every line, or of
+ * the given one followed by each of its legs.
+ */
+void list_line_lengths(output_t* out, char* str) {
+    char* name;
+    size_t length;
+    line_t* line = NULL;
+    lht_iterator_t iterator;
+    const line_stop_t* route;
+    unsigned int most = 0;
+    double *latitudes, *longitudes, *legs;
+    int i;
+
+    if ((name = input_word(&str, &length))) {
+        if (!(line = get_line_hashed(name, hash_bytes(name, length)))) {
+            output_string(out, name);
+            output_string(out, ": no such line.\n");
+            return;
+        }
+        most = line->num_stops;
+    } else
+        for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+             (line = lht_iterator_next(&iterator));)
+            if ((unsigned int)line->num_stops > most)
+                most = line->num_stops;
+
+    if (!(latitudes = malloc(sizeof(double) * 3 * (most + 1)))) {
+        output_string(out, "couldn't get memory for the lengths!\n");
+        fprintf(stderr, "maybe this should panic instead\n");
+        return;
     }
+    longitudes = latitudes + most + 1;
+    legs = longitudes + most + 1;
+
+    if (name) {
+        print_line_length(out, line,
+                          measure_line(line, latitudes, longitudes, legs));
+        route = line->stops + line->first;
+        for (i = 0; i + 1 < line->num_stops; i++) {
+            output_string(out, stop_table.names[route[i].stop]);
+            output_char(out, ' ');
+            output_string(out, stop_table.names[route[i + 1].stop]);
+            output_char(out, ' ');
+            output_fixed(out, legs[i], 0, 2);
+            output_char(out, '\n');
+        }
+    } else
+        for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+             (line = lht_iterator_next(&iterator));)
+            print_line_length(
+                out, line, measure_line(line, latitudes, longitudes, legs));
+    free(latitudes);
 }
 
 /*
- * destroys (frees) all the memory reserved for lines.
+ * sorts what was left unsorted by the staged commands.
  */
-void destroy_lines(void) {
-    line_t* curr;
-    while ((curr = lht_pop_entry(lines))) {
-        stop_dll_destroy(curr->origin);
-        free(curr->name);
-        free(curr);
+void sort_deferred(void) {
+    unsigned int i, stop, most = 0;
+    unsigned int *lines_tmp, *stops_tmp;
+
+    for (i = 0; i < num_unsorted_stops; i++)
+        if ((unsigned int)stop_table.num_lines[unsorted_stops[i]] > most)
+            most = stop_table.num_lines[unsorted_stops[i]];
+    lines_tmp = malloc(sizeof(unsigned int) * (most + 1));
+    for (i = 0; i < num_unsorted_stops; i++) {
+        stop = unsorted_stops[i];
+        sort_line_names(stop_table.records[stop].sorted_lines, lines_tmp,
+                        stop_table.num_lines[stop]);
+        stop_table.records[stop].unsorted = 0;
+    }
+    free(lines_tmp);
+    num_unsorted_stops = 0;
+
+    if (interchanges_unsorted) {
+        stops_tmp = malloc(sizeof(unsigned int) * (num_interchanges + 1));
+        sort_stops(interchanges, stops_tmp, num_interchanges);
+        free(stops_tmp);
+        interchanges_unsorted = 0;
     }
 }
 
 /*
- * destroys (frees) all the memory reserved for stops.
+ * while bulk loading (between the b and f commands), keeps a p or c command
+ * with arguments, or an l command, to be run when the batch ends. anything
+ * else has to see the network as it is, so it isn't kept.
+ * returns 1 if the command was staged, 0 otherwise.
  */
-void destroy_stops(void) {
-    stop_t* curr;
-    while ((curr = lht_pop_entry(stops))) {
-        line_dll_destroy(curr->head_lines);
-        free(curr->name);
-        free(curr);
+int stage_command(const char* command, size_t length) {
+    const char* arguments = command + 1;
+    char* new;
+    size_t capacity;
+
+    while (*arguments == ' ' || *arguments == '\t')
+        arguments++;
+    if (!(*command == 'l' ||
+          ((*command == 'p' || *command == 'c') && *arguments)))
+        return 0;
+
+    if (staged_size + length + 1 > staged_capacity) {
+        capacity = (staged_capacity) ? staged_capacity : 65536;
+        while (capacity < staged_size + length + 1)
+            capacity *= 2;
+        if (!(new = realloc(staged, capacity)))
+            return 0;
+        staged = new;
+        staged_capacity = capacity;
     }
+    memcpy(staged + staged_size, command, length + 1);
+    staged_size += length + 1;
+    if (*command == 'p')
+        num_staged_stops++;
+    else if (*command == 'c')
+        num_staged_lines++;
+    return 1;
+}
+
+/*
+ * runs the staged commands, in the order they came (so is their output).
+ * the hash tables are sized for them first, and the line names of the stops
+ * and the interchanges are only sorted at the end.
+ */
+void run_staged(output_t* out) {
+    char *command, *next;
+
+    if (!staged_size)
+        return;
+    lht_reserve(stops, num_staged_stops);
+    stop_table_reserve(&stop_table, num_staged_stops);
+    lht_reserve(lines, num_staged_lines);
+
+    deferring = 1;
+    for (command = staged; command < staged + staged_size; command = next) {
+        /* the command is cut in place as it runs */
+        next = command + strlen(command) + 1;
+        switch (*command) {
+        case 'c':
+            list_or_add_line(out, command + 1);
+            break;
+        case 'p':
+            list_or_add_stop(out, command + 1);
+            break;
+        case 'l':
+            add_connection(out, command + 1);
+            break;
+        }
+    }
+    deferring = 0;
+    sort_deferred();
+
+    staged_size = 0;
+    num_staged_stops = num_staged_lines = 0;
 }
 
 /*
  * destroys all the memory allocated for the system (except the global
  * containers).
+ * everything comes from the pools, so there is no need to walk the network.
+ */
+void destroy(void) {
+    /* no listing may still be reading the network */
+    if (readers.num_threads)
+        readers_synchronize(&readers);
+    lht_clear(lines);
+    lht_clear(stops);
+    pool_reset(&line_pool);
+    stop_table_clear(&stop_table);
+    sizepool_reset(&blocks);
+    num_line_ids = num_free_line_ids = 0;
+    num_interchanges = 0;
+    num_stops_added = 0;
+    route_invalidate(&routes);
+    spatial_clear(&spatial);
+}
+
+/*
+ * writes the whole network to a snapshot in the given file.
+ * the stops are numbered as they are listed, which is also the order they were
+ * added in (so their order is renumbered the same way).
+ * returns 0 if ok, -1 if the file couldn't be written.
+ */
+int save_network(const char* path) {
+    snapshot_writer_t writer;
+    const unsigned int* listing;
+    unsigned int stop;
+    line_t* line;
+    lht_iterator_t iterator;
+    const line_stop_t *current, *end;
+    unsigned long num_nodes = 0, names_size = 0, i = 0;
+    int failed = 0;
+
+    /* without holes, the listing has the stops by index */
+    stop_table_pack(&stop_table);
+    listing = stop_table.listing;
+    for (i = 0; i < stop_table.num_stops; i++) {
+        stop_table.records[listing[i]].order = i;
+        names_size += strlen(stop_table.names[listing[i]]) + 1;
+    }
+    num_stops_added = i;
+    for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+         (line = lht_iterator_next(&iterator));) {
+        num_nodes += line->num_stops;
+        names_size += strlen(line->name) + 1;
+    }
+
+    if (snapshot_begin(&writer, path, stop_table.num_stops, lht_get_size(lines),
+                       num_nodes, names_size))
+        return -1;
+    for (i = 0; i < stop_table.num_stops && !failed; i++) {
+        stop = listing[i];
+        failed = snapshot_stop(&writer, stop_table.latitudes[stop],
+                               stop_table.longitudes[stop],
+                               stop_table.names[stop]);
+    }
+    for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES), i = 0;
+         (line = lht_iterator_next(&iterator)) && !failed;) {
+        failed = snapshot_line(&writer, line->total_cost, line->total_duration,
+                               line->name, i, line->num_stops);
+        i += line->num_stops;
+    }
+    for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+         (line = lht_iterator_next(&iterator)) && !failed;) {
+        end = line->stops + line->first + line->num_stops;
+        for (current = line->stops + line->first; current < end && !failed;
+             current++)
+            failed = snapshot_node(&writer, current->cost, current->duration,
+                                   stop_order(current->stop));
+    }
+    for (i = 0; i < stop_table.num_stops && !failed; i++)
+        failed = snapshot_name(&writer, stop_table.names[listing[i]]);
+    for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+         (line = lht_iterator_next(&iterator)) && !failed;)
+        failed = snapshot_name(&writer, line->name);
+
+    return (snapshot_end(&writer) || failed) ? -1 : 0;
+}
+
+/*
+ * builds the route of a line from its nodes in the snapshot.
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int load_line(line_t* line, const snapshot_line_t* record,
+              const snapshot_node_t* nodes, const unsigned int* by_index) {
+    unsigned long i;
+
+    for (i = 0; i < record->num_stops; i++)
+        if (line_add_stop(line, by_index[nodes[i].stop], 0, nodes[i].cost,
+                          nodes[i].duration))
+            return -1;
+    line->total_cost = record->total_cost;
+    line->total_duration = record->total_duration;
+    return 0;
+}
+
+/*
+ * replaces the network with the one in the snapshot in the given file.
+ * the hash tables are sized for it up front, and the indexes of the stops are
+ * sorted once at the end, as in a bulk load.
+ * returns 0 if ok, -1 if the snapshot couldn't be read (the network is left as
+ * it was) or loaded (the network is left empty).
+ */
+int load_network(output_t* out, const char* path) {
+    snapshot_t snapshot;
+    const snapshot_header_t* header;
+    const snapshot_stop_t* stop;
+    const snapshot_line_t* line;
+    line_t* current;
+    lht_iterator_t iterator;
+    const char* name;
+    unsigned long i;
+    size_t hash;
+    int failed = 0;
+
+    if (snapshot_open(&snapshot, path))
+        return -1;
+    header = snapshot.header;
+
+    destroy();
+    lht_reserve(stops, header->num_stops);
+    stop_table_reserve(&stop_table, header->num_stops);
+    lht_reserve(lines, header->num_lines);
+    deferring = 1;
+    for (i = 0; i < header->num_stops && !failed; i++) {
+        stop = snapshot.stops + i;
+        name = snapshot.names + stop->name;
+        failed = add_new_stop(out, name, hash_string(name), stop->latitude,
+                              stop->longitude) ||
+                 lht_get_size(stops) != i + 1;
+    }
+    for (i = 0; i < header->num_lines && !failed; i++) {
+        name = snapshot.names + snapshot.lines[i].name;
+        if ((failed = get_line_hashed(name, hash = hash_string(name)) != NULL))
+            break;
+        add_new_line(out, name, hash);
+        failed = lht_get_size(lines) != i + 1;
+    }
+    /*
+     * both were added in order (to an empty network, so the listing of the
+     * stops has no holes): the lists have them by index
+     */
+    if (!failed) {
+        for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES), i = 0;
+             (current = lht_iterator_next(&iterator)) && !failed; i++) {
+            line = snapshot.lines + i;
+            failed = load_line(current, line, snapshot.nodes + line->first_node,
+                               stop_table.listing);
+        }
+    }
+    deferring = 0;
+    sort_deferred();
+
+    snapshot_close(&snapshot);
+    if (failed) {
+        destroy();
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * w command.
+ * writes the network to a snapshot in the given file.
  */
-__always_inline void destroy(void) {
-    destroy_lines();
-    destroy_stops();
+void write_snapshot(output_t* out, char* str) {
+    char* path;
+
+    if (!(path = input_name(&str, NULL)))
+        return;
+    if (save_network(path)) {
+        output_string(out, path);
+        output_string(out, ": couldn't write snapshot.\n");
+    }
 }
 
-int main(void) {
-    char *buffer, *buffer_offset;
+/*
+ * o command.
+ * replaces the network with the one in the snapshot in the given file.
+ */
+void read_snapshot(output_t* out, char* str) {
+    char* path;
+
+    if (!(path = input_name(&str, NULL)))
+        return;
+    if (load_network(out, path)) {
+        output_string(out, path);
+        output_string(out, ": couldn't load snapshot.\n");
+    }
+}
+
+/*
+ * what the input does before it waits for more commands: the output so far is
+ * written out, with the listings the readers are printing (if there are any).
+ */
+void flush_output(void* out) {
+    if (readers.num_threads)
+        readers_flush(&readers);
+    else
+        output_flush(out);
+}
+
+/*
+ * runs a command (cut into words in place), which isn't staged.
+ * returns 1 if it was q, 0 otherwise.
+ */
+int run_command(output_t* out, char* buffer) {
     int exit = 0;
+#ifdef STATS
+    output_t err;
+#endif
+
+    switch (*buffer) {
+    case 'q':
+        exit++;
+#ifdef STATS
+        output_init(&err, stderr);
+        stats_print(&err);
+        output_destroy(&err);
+#endif
+        /* FALLTHRU */
+    case 'a':
+        destroy();
+        break;
+    case 'c':
+        list_or_add_line(out, buffer + 1);
+        break;
+    case 'r':
+        remove_line(out, buffer + 1);
+        break;
+    case 'p':
+        list_or_add_stop(out, buffer + 1);
+        break;
+    case 'e':
+        remove_stop(out, buffer + 1);
+        break;
+    case 'l':
+        add_connection(out, buffer + 1);
+        break;
+    case 'i':
+        list_interconnections(out, buffer + 1);
+        break;
+    case 't':
+        find_route(out, buffer + 1);
+        break;
+    case 'n':
+        list_nearest_stops(out, buffer + 1);
+        break;
+    case 'g':
+        list_stops_in_box(out, buffer + 1);
+        break;
+    case 'd':
+        list_line_lengths(out, buffer + 1);
+        break;
+    case 'w':
+        write_snapshot(out, buffer + 1);
+        break;
+    case 'o':
+        read_snapshot(out, buffer + 1);
+        break;
+    case 'b':
+        bulk_loading = 1;
+        break;
+    case 'f':
+        /* what was staged has already run */
+        bulk_loading = 0;
+        break;
+#ifdef STATS
+    case 's':
+        stats_print(out);
+        break;
+#endif
+    default:
+        /* do nothing */
+        break;
+    }
+    return exit;
+}
+
+/*
+ * a command from a client of the server, run as if it came from the standard
+ * input: except that q only ends the session (the network stays for the other
+ * clients), and that only one client bulk loads at a time. the commands it
+ * staged are run as soon as another client sends one, as they would anyway.
+ */
+int serve_command(void* context, server_client_t* client, char* buffer,
+                  size_t length) {
+    int end = 0;
+#ifdef STATS
+    double start;
+#endif
+    (void)context;
+
+    if (bulk_client == client && stage_command(buffer, length))
+        return 0;
+    if (bulk_client)
+        run_staged(&bulk_client->out);
+#ifdef STATS
+    start = stats_now();
+#endif
+    switch (*buffer) {
+    case 'q':
+        end = 1;
+        /* FALLTHRU */
+    case 'f':
+        if (bulk_client == client)
+            bulk_client = NULL;
+        break;
+    case 'b':
+        bulk_client = client;
+        break;
+    default:
+        run_command(&client->out, buffer);
+        break;
+    }
+#ifdef STATS
+    stats_command(*buffer, stats_now() - start);
+#endif
+    return end;
+}
+
+/*
+ * the session of a client of the server ended: the commands it staged are run.
+ */
+void serve_ended(void* context, server_client_t* client) {
+    (void)context;
+    if (bulk_client == client) {
+        run_staged(&client->out);
+        bulk_client = NULL;
+    }
+}
+
+/*
+ * -S: serves the clients of a socket at the given path until SIGINT or
+ * SIGTERM.
+ * returns 0 if ok, -1 if the socket couldn't be set up (or epoll failed).
+ */
+int serve(const char* path) {
+    server_t server;
+    int status;
+
+    if (server_init(&server, path, serve_command, serve_ended, NULL))
+        return -1;
+    status = server_run(&server);
+    server_destroy(&server);
+    return status;
+}
+
+/*
+ * usage: proj2 [-j readers] [-S socket] [snapshot]
+ */
+int main(int argc, char** argv) {
+    char* buffer;
+    size_t length;
+    int exit = 0, status = 0, argument = 1, num_readers = 0;
+    const char* socket_path = NULL;
+    output_t out;
+    output_t* current;
+    input_t in;
+#ifdef STATS
+    double start;
+#endif
     lines = lht_init();
     stops = lht_init();
     if (!lines || !stops) {
@@ -688,49 +1780,80 @@ int main(void) {
         fprintf(stderr, "maybe this should panic instead\n");
         return 1;
     }
-    buffer = (char*)malloc(sizeof(char) * MAX_INPUT);
-    if (!buffer) {
-        printf("couldn't get memory for the new hash tables!\n");
+    stop_table_init(&stop_table);
+    pool_init(&line_pool, sizeof(line_t));
+    sizepool_init(&blocks);
+    route_init(&routes);
+    spatial_init(&spatial);
+    output_init(&out, stdout);
+    if (input_init(&in, 0, flush_output, &out)) {
+        printf("couldn't get memory for the input buffer!\n");
+        fprintf(stderr, "maybe this should panic instead\n");
+        return 1;
+    }
+    for (; argument + 1 < argc && argv[argument][0] == '-'; argument += 2)
+        if (!strcmp(argv[argument], "-j"))
+            num_readers = atoi(argv[argument + 1]);
+        else if (!strcmp(argv[argument], "-S"))
+            socket_path = argv[argument + 1];
+        else
+            break;
+    /* the readers print to the standard output only */
+    if (num_readers > 0 && !socket_path &&
+        readers_init(&readers, num_readers, &out, &blocks)) {
+        /* the listings are just printed as they come */
+        output_string(&out, "couldn't start the readers!\n");
         fprintf(stderr, "maybe this should panic instead\n");
     }
+    if (argc > argument && load_network(&out, argv[argument])) {
+        output_string(&out, argv[argument]);
+        output_string(&out, ": couldn't load snapshot.\n");
+        exit = status = 1;
+    }
+    if (!exit && socket_path) {
+        if (serve(socket_path)) {
+            output_string(&out, socket_path);
+            output_string(&out, ": couldn't serve the socket.\n");
+            status = 1;
+        }
+        destroy();
+        exit = 1;
+    }
 
-    buffer_offset = buffer;
-
-    buffer_offset++;
     while (!exit) {
-        fgets(buffer, BUFSIZ, stdin);
-        switch (*buffer) {
-        case 'q':
-            exit++;
-            /* FALLTHRU */
-        case 'a':
+        if (!(buffer = input_line(&in, &length))) {
+            /* the input ended without a q command */
+            run_staged((readers.num_threads) ? readers_output(&readers) : &out);
             destroy();
             break;
-        case 'c':
-            list_or_add_line(buffer_offset);
-            break;
-        case 'r':
-            remove_line(buffer_offset);
-            break;
-        case 'p':
-            list_or_add_stop(buffer_offset);
-            break;
-        case 'e':
-            remove_stop(buffer_offset);
-            break;
-        case 'l':
-            add_connection(buffer_offset);
-            break;
-        case 'i':
-            list_interconnections(buffer_offset);
-            break;
-        default:
-            /* do nothing */
-            break;
         }
+        if (bulk_loading && stage_command(buffer, length))
+            continue;
+        /* after the listings still being printed, if there are any */
+        current = (readers.num_threads) ? readers_output(&readers) : &out;
+        run_staged(current);
+#ifdef STATS
+        start = stats_now();
+#endif
+        exit = run_command(current, buffer);
+        if (readers.num_threads)
+            readers_drain(&readers);
+#ifdef STATS
+        stats_command(*buffer, stats_now() - start);
+#endif
     }
+    readers_destroy(&readers);
+    input_destroy(&in);
+    output_destroy(&out);
     lht_destroy(lines);
     lht_destroy(stops);
-    free(buffer);
-    return 0;
+    free(line_ids);
+    free(free_line_ids);
+    free(interchanges);
+    free(staged);
+    free(unsorted_stops);
+    route_destroy(&routes);
+    spatial_destroy(&spatial);
+    stop_table_destroy(&stop_table);
+    return status;
 }
@@ -1,52 +1,62 @@
 #ifndef MAIN_HEADER
+#define MAIN_HEADER
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "line-set.h"
+
 #define STOP_NAME_LENGTH 50
 #define LINE_NAME_LENGTH 20
 #define MAX_INPUT 65535
+/* stops in the first array of a line's route */
+#define LINE_FIRST_CAPACITY 8
 
-#define DELIMITERS " \t\n"
 #define INVERT "inverso"
+#define ROUTE_BY_COST "cost"
+#define ROUTE_BY_DURATION "duration"
 
-typedef struct {
-    double latitude;
-    double longitude;
-} location_t;
+/* no stop has this id */
+#define NO_STOP ((unsigned int)-1)
 
-typedef struct line_node line_node_t;
+typedef struct line line_t;
 
+/*
+ * what is kept of a stop besides its name, location and number of lines (see
+ * stop-table.h).
+ */
 typedef struct {
-    char* name;
-    location_t locale;
-    int num_lines;
-    line_node_t* head_lines;
-    line_node_t* tail_lines;
+    line_set_t lines; /* ids of the lines passing by the stop */
+    /* ids of those lines, in alphabetic order of their names */
+    unsigned int* sorted_lines;
+    unsigned int sorted_lines_capacity;
+    unsigned long order; /* when the stop was added, orders the interchanges */
+    unsigned int position; /* in the listing of the stops */
+    int unsorted; /* its lines wait for the end of a bulk load to be sorted */
 } stop_t;
 
-typedef struct stop_node {
-    stop_t* raw;
-    struct stop_node* next;
-    struct stop_node* prev;
+/* a stop in the route of a line, with the link arriving at it */
+typedef struct {
+    unsigned int stop; /* id */
     double cost;
     double duration;
-} stop_node_t;
+} line_stop_t;
 
-typedef struct line {
+struct line {
     char* name;
-    stop_node_t* origin;
-    stop_node_t* destination;
+    unsigned int id; /* dense, reused after the line is removed */
+    /*
+     * the route, from origin to destination, at stops[first] to
+     * stops[first + num_stops - 1]: there is room left at both ends, so
+     * stops can be added to either one.
+     */
+    line_stop_t* stops;
+    unsigned int first;
+    unsigned int capacity;
     double total_cost;
     double total_duration;
     int num_stops;
-} line_t;
-
-struct line_node {
-    line_t* raw;
-    struct line_node* next;
-    struct line_node* prev;
 };
 
 #endif /* !MAIN_HEADER */
@@ -0,0 +1,300 @@
+#include "output.h"
+#include <limits.h>
+
+/* the biggest number of decimals output_fixed() handles by itself */
+#define FIXED_MAX_DECIMALS 12
+/* enough for any double printed with "%.*f" by the fallback */
+#define FIXED_FALLBACK_SIZE 400
+
+/*
+ * initializes an empty output buffer, writing to the given file (or growing in
+ * memory if it is NULL).
+ * returns 0 if ok, -1 if there wasn't memory for the buffer.
+ */
+int output_init(output_t* self, FILE* file) {
+    self->capacity = (file) ? OUTPUT_BUFFER_SIZE : 256;
+    self->size = 0;
+    self->file = file;
+    if (!(self->data = malloc(self->capacity))) {
+        self->capacity = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * flushes what is left and frees the buffer.
+ */
+void output_destroy(output_t* self) {
+    output_flush(self);
+    free(self->data);
+    self->data = NULL;
+    self->capacity = 0;
+}
+
+/*
+ * writes everything in the buffer to the file.
+ * it does nothing for in-memory buffers.
+ */
+void output_flush(output_t* self) {
+    if (!self->file)
+        return;
+    if (self->size)
+        fwrite(self->data, 1, self->size, self->file);
+    fflush(self->file);
+    self->size = 0;
+}
+
+/*
+ * makes room for (at least) the given number of bytes.
+ * returns a pointer to where they go, or NULL if there wasn't memory.
+ */
+char* output_reserve(output_t* self, size_t length) {
+    size_t capacity;
+    char* data;
+
+    if (self->capacity - self->size >= length)
+        return self->data + self->size;
+
+    if (self->file) {
+        output_flush(self);
+        if (self->capacity >= length)
+            return self->data;
+    }
+    for (capacity = self->capacity * 2 + 1; capacity < self->size + length;)
+        capacity *= 2;
+    if (!(data = realloc(self->data, capacity)))
+        return NULL;
+    self->data = data;
+    self->capacity = capacity;
+    return self->data + self->size;
+}
+
+/*
+ * appends the given bytes.
+ */
+void output_bytes(output_t* self, const char* bytes, size_t length) {
+    char* to;
+    /* big chunks go straight to the file */
+    if (self->file && length >= self->capacity) {
+        output_flush(self);
+        fwrite(bytes, 1, length, self->file);
+        return;
+    }
+    if ((to = output_reserve(self, length))) {
+        memcpy(to, bytes, length);
+        self->size += length;
+    }
+}
+
+/*
+ * appends a string.
+ */
+void output_string(output_t* self, const char* str) {
+    output_bytes(self, str, strlen(str));
+}
+
+/*
+ * appends a single character.
+ */
+void output_char(output_t* self, char c) {
+    if (self->size < self->capacity)
+        self->data[self->size++] = c;
+    else
+        output_bytes(self, &c, 1);
+}
+
+/*
+ * writes the decimal digits of the given number, right to left, ending at the
+ * given position.
+ * returns a pointer to the first digit.
+ */
+char* write_digits(char* end, unsigned long value) {
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    return end;
+}
+
+/*
+ * appends an integer, same as "%ld".
+ */
+void output_int(output_t* self, long value) {
+    char digits[sizeof(long) * CHAR_BIT / 3 + 3];
+    char* end = digits + sizeof(digits);
+    char* start;
+
+    if (value < 0) {
+        start = write_digits(end, -(unsigned long)value);
+        *--start = '-';
+    } else
+        start = write_digits(end, value);
+    output_bytes(self, start, end - start);
+}
+
+#if ULONG_MAX > 0xffffffffUL
+
+/* 128 bit unsigned number, in two 64 bit halves */
+typedef struct {
+    unsigned long high;
+    unsigned long low;
+} u128_t;
+
+#define LOW32(x) ((x)&0xffffffffUL)
+
+/*
+ * full product of two 64 bit numbers.
+ */
+u128_t multiply(unsigned long a, unsigned long b) {
+    unsigned long ll = LOW32(a) * LOW32(b);
+    unsigned long lh = LOW32(a) * (b >> 32);
+    unsigned long hl = (a >> 32) * LOW32(b);
+    unsigned long hh = (a >> 32) * (b >> 32);
+    unsigned long middle = (ll >> 32) + LOW32(lh) + LOW32(hl);
+    u128_t result;
+    result.low = (middle << 32) | LOW32(ll);
+    result.high = hh + (lh >> 32) + (hl >> 32) + (middle >> 32);
+    return result;
+}
+
+/*
+ * the given number shifted by count bits (0 < count < 128) to the right.
+ */
+u128_t shift_right(u128_t x, int count) {
+    if (count >= 64) {
+        x.low = x.high >> (count - 64);
+        x.high = 0;
+    } else {
+        x.low = (x.low >> count) | (x.high << (64 - count));
+        x.high >>= count;
+    }
+    return x;
+}
+
+/*
+ * checks if any of the lowest count bits (0 < count < 128) is set.
+ */
+int low_bits_set(u128_t x, int count) {
+    if (count >= 64)
+        return x.low || (count > 64 && x.high << (128 - count));
+    return (x.low << (64 - count)) != 0;
+}
+
+/*
+ * checks if the given bit (0 <= bit < 128) is set.
+ */
+int bit_set(u128_t x, int bit) {
+    return (bit >= 64) ? (x.high >> (bit - 64)) & 1 : (x.low >> bit) & 1;
+}
+
+/*
+ * the given double times 10^decimals, rounded to the nearest integer (ties to
+ * even), computed exactly from its binary representation.
+ * returns 0 if ok, -1 if it doesn't fit in an unsigned long (or isn't finite).
+ */
+int scale_exactly(double value, int decimals, unsigned long* result) {
+    static const unsigned long powers[] = {1UL,
+                                           10UL,
+                                           100UL,
+                                           1000UL,
+                                           10000UL,
+                                           100000UL,
+                                           1000000UL,
+                                           10000000UL,
+                                           100000000UL,
+                                           1000000000UL,
+                                           10000000000UL,
+                                           100000000000UL,
+                                           1000000000000UL};
+    unsigned long bits, mantissa;
+    int exponent;
+    u128_t product;
+
+    memcpy(&bits, &value, sizeof(bits));
+    exponent = (bits >> 52) & 0x7ff;
+    mantissa = bits & ((1UL << 52) - 1);
+    if (exponent == 0x7ff)
+        return -1;
+    if (exponent)
+        mantissa |= 1UL << 52;
+    else
+        exponent = 1;
+    /* value = mantissa * 2^exponent */
+    exponent -= 1075;
+
+    product = multiply(mantissa, powers[decimals]);
+    if (exponent >= 0) {
+        /* a (big) integer */
+        if (exponent > 10 || product.high)
+            return -1;
+        if (exponent && product.low >> (64 - exponent))
+            return -1;
+        *result = product.low << exponent;
+        return 0;
+    }
+    if (-exponent >= 128) {
+        /* way below a half */
+        *result = 0;
+        return 0;
+    }
+
+    *result = shift_right(product, -exponent).low;
+    if (shift_right(product, -exponent).high)
+        return -1;
+    /* rounding, by what was shifted out */
+    if (bit_set(product, -exponent - 1) &&
+        (low_bits_set(product, -exponent - 1) || (*result & 1)))
+        (*result)++;
+    return 0;
+}
+
+#else
+
+/*
+ * without 64 bit longs there is no fast path.
+ */
+int scale_exactly(double value, int decimals, unsigned long* result) {
+    (void)value;
+    (void)decimals;
+    (void)result;
+    return -1;
+}
+
+#endif
+
+/*
+ * appends a double, exactly like printf("%*.*f", width, decimals, value).
+ * values whose digits don't fit in an unsigned long go through sprintf.
+ */
+void output_fixed(output_t* self, double value, int width, int decimals) {
+    char digits[sizeof(long) * CHAR_BIT / 3 + FIXED_MAX_DECIMALS + 4];
+    char fallback[FIXED_FALLBACK_SIZE];
+    char *end = digits + sizeof(digits), *start;
+    unsigned long scaled;
+    int length;
+
+    if (decimals > FIXED_MAX_DECIMALS || value >= 1e300 || value <= -1e300 ||
+        scale_exactly(value, decimals, &scaled)) {
+        length = sprintf(fallback, "%*.*f", width, decimals, value);
+        output_bytes(self, fallback, length);
+        return;
+    }
+
+    start = write_digits(end, scaled);
+    /* at least one digit before the point */
+    while (end - start <= decimals)
+        *--start = '0';
+    if (decimals) {
+        /* the integer part moves one place to the left for the point */
+        memmove(start - 1, start, end - start - decimals);
+        start--;
+        end[-decimals - 1] = '.';
+    }
+    /* the sign bit is printed even if it rounds to zero */
+    if (value < 0 || (value == 0 && 1 / value < 0))
+        *--start = '-';
+    while (end - start < width)
+        *--start = ' ';
+    output_bytes(self, start, end - start);
+}
@@ -0,0 +1,31 @@
+#ifndef OUTPUT_HEADER
+#define OUTPUT_HEADER
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* bytes gathered before they are written to the file */
+#define OUTPUT_BUFFER_SIZE 65536
+
+/*
+ * user-space output buffer.
+ * if it has a file, it is written to it when full (or flushed); otherwise the
+ * buffer just grows, to be taken by whoever owns it.
+ */
+typedef struct output {
+    char* data;
+    size_t size;
+    size_t capacity;
+    FILE* file;
+} output_t;
+
+int output_init(output_t* self, FILE* file);
+void output_destroy(output_t* self);
+void output_flush(output_t* self);
+void output_bytes(output_t* self, const char* bytes, size_t length);
+void output_string(output_t* self, const char* str);
+void output_char(output_t* self, char c);
+void output_int(output_t* self, long value);
+void output_fixed(output_t* self, double value, int width, int decimals);
+
+#endif /* !OUTPUT_HEADER */
@@ -0,0 +1,196 @@
+#include "pool.h"
+
+/* the strictest alignment an object may need */
+typedef union {
+    void* pointer;
+    double number;
+    long integer;
+} pool_align_t;
+
+#define ALIGN(size)                                                            \
+    (((size) + sizeof(pool_align_t) - 1) / sizeof(pool_align_t) *              \
+     sizeof(pool_align_t))
+
+struct pool_slab {
+    pool_slab_t* next;
+};
+
+struct sizepool_large {
+    sizepool_large_t* next;
+    sizepool_large_t* prev;
+};
+
+/*
+ * initializes an empty pool for objects of the given size.
+ * no memory is reserved until the first allocation.
+ */
+void pool_init(pool_t* self, size_t object_size) {
+    /* freed objects hold the link to the next free one */
+    if (object_size < sizeof(void*))
+        object_size = sizeof(void*);
+    self->object_size = ALIGN(object_size);
+    self->slab_objects = POOL_FIRST_SLAB;
+    self->slabs = NULL;
+    self->bump = self->end = NULL;
+    self->free_list = NULL;
+}
+
+/*
+ * gets memory for a new object.
+ * returns NULL if there isn't any memory left.
+ */
+void* pool_alloc(pool_t* self) {
+    pool_slab_t* slab;
+    void* object;
+
+    /* reuses a freed object */
+    if ((object = self->free_list)) {
+        memcpy(&self->free_list, object, sizeof(void*));
+        return object;
+    }
+
+    /* the current slab is full */
+    if (self->bump == self->end) {
+        slab = malloc(ALIGN(sizeof(pool_slab_t)) +
+                      self->object_size * self->slab_objects);
+        if (!slab)
+            return NULL;
+        slab->next = self->slabs;
+        self->slabs = slab;
+        self->bump = (char*)slab + ALIGN(sizeof(pool_slab_t));
+        self->end = self->bump + self->object_size * self->slab_objects;
+        if (self->slab_objects < POOL_MAX_SLAB)
+            self->slab_objects *= 2;
+    }
+
+    object = self->bump;
+    self->bump += self->object_size;
+    return object;
+}
+
+/*
+ * gives an object back to the pool (it will be reused by the next alloc).
+ */
+void pool_free(pool_t* self, void* object) {
+    if (!object)
+        return;
+    memcpy(object, &self->free_list, sizeof(void*));
+    self->free_list = object;
+}
+
+/*
+ * releases every object of the pool at once, without looking at them.
+ * the pool can be used again afterwards.
+ */
+void pool_reset(pool_t* self) {
+    pool_slab_t* next;
+    while (self->slabs) {
+        next = self->slabs->next;
+        free(self->slabs);
+        self->slabs = next;
+    }
+    self->slab_objects = POOL_FIRST_SLAB;
+    self->bump = self->end = NULL;
+    self->free_list = NULL;
+}
+
+/*
+ * initializes an empty block pool.
+ */
+void sizepool_init(sizepool_t* self) {
+    int i;
+    for (i = 0; i < SIZEPOOL_CLASSES; i++)
+        pool_init(&self->classes[i], SIZEPOOL_MIN_SIZE << i);
+    self->large = NULL;
+}
+
+/*
+ * returns the size class of a block with the given size, or -1 if it's too big
+ * for all of them.
+ */
+int sizepool_class(size_t size) {
+    int i;
+    for (i = 0; i < SIZEPOOL_CLASSES; i++)
+        if (size <= (size_t)SIZEPOOL_MIN_SIZE << i)
+            return i;
+    return -1;
+}
+
+/*
+ * gets memory for a block of the given size.
+ * returns NULL if there isn't any memory left.
+ */
+void* sizepool_alloc(sizepool_t* self, size_t size) {
+    int i = sizepool_class(size);
+    sizepool_large_t* large;
+
+    if (i >= 0)
+        return pool_alloc(&self->classes[i]);
+
+    if (!(large = malloc(ALIGN(sizeof(sizepool_large_t)) + size)))
+        return NULL;
+    large->prev = NULL;
+    if ((large->next = self->large))
+        large->next->prev = large;
+    self->large = large;
+    return (char*)large + ALIGN(sizeof(sizepool_large_t));
+}
+
+/*
+ * gives a block from sizepool_alloc() back to the pool.
+ */
+void sizepool_free(sizepool_t* self, void* block, size_t size) {
+    int i = sizepool_class(size);
+    sizepool_large_t* large;
+
+    if (!block)
+        return;
+    if (i >= 0) {
+        pool_free(&self->classes[i], block);
+        return;
+    }
+    large = (sizepool_large_t*)((char*)block -
+                                ALIGN(sizeof(sizepool_large_t)));
+    if (large->next)
+        large->next->prev = large->prev;
+    if (large->prev)
+        large->prev->next = large->next;
+    else
+        self->large = large->next;
+    free(large);
+}
+
+/*
+ * releases every block of the pool at once.
+ */
+void sizepool_reset(sizepool_t* self) {
+    sizepool_large_t* next;
+    int i;
+    for (i = 0; i < SIZEPOOL_CLASSES; i++)
+        pool_reset(&self->classes[i]);
+    while (self->large) {
+        next = self->large->next;
+        free(self->large);
+        self->large = next;
+    }
+}
+
+/*
+ * copies the given string into memory of the pool.
+ * returns NULL if there isn't any memory left.
+ */
+char* sizepool_strdup(sizepool_t* self, const char* str) {
+    size_t size = strlen(str) + 1;
+    char* new;
+
+    if ((new = sizepool_alloc(self, size)))
+        memcpy(new, str, size);
+    return new;
+}
+
+/*
+ * gives a string from sizepool_strdup() back to the pool.
+ */
+void sizepool_strfree(sizepool_t* self, char* str) {
+    sizepool_free(self, str, strlen(str) + 1);
+}
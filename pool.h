@@ -0,0 +1,57 @@
+#ifndef POOL_HEADER
+#define POOL_HEADER
+#include <stdlib.h>
+#include <string.h>
+
+/* objects in the first slab of a pool, each new slab doubles it */
+#define POOL_FIRST_SLAB 32
+/* objects in the biggest slabs */
+#define POOL_MAX_SLAB 65536
+
+/* number of size classes for blocks (16, 32, ... bytes) */
+#define SIZEPOOL_CLASSES 7
+#define SIZEPOOL_MIN_SIZE 16
+
+typedef struct pool_slab pool_slab_t;
+
+/*
+ * fixed-size object allocator.
+ * objects are carved out of big slabs (by bumping a pointer) and the freed ones
+ * are kept in a list to be reused, so nothing is given back to the system
+ * until the whole pool is reset.
+ */
+typedef struct pool {
+    size_t object_size;
+    size_t slab_objects; /* objects in the next slab */
+    pool_slab_t* slabs;
+    char* bump;
+    char* end;
+    void* free_list;
+} pool_t;
+
+typedef struct sizepool_large sizepool_large_t;
+
+/*
+ * variable-size block allocator, with a pool per size class.
+ * blocks that don't fit the biggest class are malloc'd, but still tracked,
+ * so a reset also releases them.
+ * the size of a block must be given back when freeing it.
+ */
+typedef struct sizepool {
+    pool_t classes[SIZEPOOL_CLASSES];
+    sizepool_large_t* large;
+} sizepool_t;
+
+void pool_init(pool_t* self, size_t object_size);
+void* pool_alloc(pool_t* self);
+void pool_free(pool_t* self, void* object);
+void pool_reset(pool_t* self);
+
+void sizepool_init(sizepool_t* self);
+void* sizepool_alloc(sizepool_t* self, size_t size);
+void sizepool_free(sizepool_t* self, void* block, size_t size);
+void sizepool_reset(sizepool_t* self);
+char* sizepool_strdup(sizepool_t* self, const char* str);
+void sizepool_strfree(sizepool_t* self, char* str);
+
+#endif /* !POOL_HEADER */
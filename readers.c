@@ -0,0 +1,404 @@
+#define _POSIX_C_SOURCE 200112L
+#include "readers.h"
+#include <pthread.h>
+
+struct readers_sync {
+    pthread_t threads[READERS_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t work;     /* a job was queued (or the threads must stop) */
+    pthread_cond_t finished; /* a job was done */
+};
+
+/*
+ * prints the line as the listing of all the lines does.
+ */
+void readers_print_line(output_t* out, const readers_line_t* line) {
+    output_string(out, line->name);
+    if (line->origin) {
+        output_char(out, ' ');
+        output_string(out, line->origin);
+        output_char(out, ' ');
+        output_string(out, line->destination);
+    }
+    output_char(out, ' ');
+    output_int(out, line->num_stops);
+    output_char(out, ' ');
+    output_fixed(out, line->total_cost, 0, 2);
+    output_char(out, ' ');
+    output_fixed(out, line->total_duration, 0, 2);
+    output_char(out, '\n');
+}
+
+/*
+ * prints the stop as the listing of all the stops does.
+ */
+void readers_print_stop(output_t* out, const readers_stop_t* stop) {
+    output_string(out, stop->name);
+    output_bytes(out, ": ", 2);
+    output_fixed(out, stop->latitude, 16, 12);
+    output_char(out, ' ');
+    output_fixed(out, stop->longitude, 16, 12);
+    output_char(out, ' ');
+    output_int(out, stop->num_lines);
+    output_char(out, '\n');
+}
+
+/*
+ * prints the interchange as the i command does.
+ */
+void readers_print_interchange(output_t* out,
+                               const readers_interchange_t* interchange,
+                               const char** names) {
+    const char** line = names + interchange->first_line;
+    int i;
+
+    output_string(out, interchange->name);
+    output_char(out, ' ');
+    output_int(out, interchange->num_lines);
+    output_char(out, ':');
+    for (i = 0; i < interchange->num_lines; i++) {
+        output_char(out, ' ');
+        output_string(out, line[i]);
+    }
+    output_char(out, '\n');
+}
+
+/*
+ * prints the listing of the job, to its own output.
+ */
+void readers_run(readers_job_t* job) {
+    unsigned int i;
+
+    for (i = 0; i < job->num_rows; i++)
+        switch (job->command) {
+        case 'c':
+            readers_print_line(&job->out, (readers_line_t*)job->rows + i);
+            break;
+        case 'p':
+            readers_print_stop(&job->out, (readers_stop_t*)job->rows + i);
+            break;
+        case 'i':
+            readers_print_interchange(
+                &job->out, (readers_interchange_t*)job->rows + i, job->names);
+            break;
+        }
+}
+
+/*
+ * a reader: runs the jobs as they are queued, until the pool stops (and
+ * there are none left).
+ */
+void* readers_thread(void* pool) {
+    readers_t* self = pool;
+    readers_sync_t* sync = self->sync;
+    readers_job_t* job;
+
+    pthread_mutex_lock(&sync->lock);
+    for (;;) {
+        while (!self->to_run && !self->stopping)
+            pthread_cond_wait(&sync->work, &sync->lock);
+        if (!(job = self->to_run))
+            break;
+        if (!(self->to_run = job->next_to_run))
+            self->last_to_run = NULL;
+        pthread_mutex_unlock(&sync->lock);
+
+        readers_run(job);
+
+        pthread_mutex_lock(&sync->lock);
+        job->done = 1;
+        pthread_cond_signal(&sync->finished);
+    }
+    pthread_mutex_unlock(&sync->lock);
+    return NULL;
+}
+
+/*
+ * starts the given number of reader threads, writing in order to out, and
+ * giving the retired names back to the given pool.
+ * returns 0 if ok, -1 if no thread could be started.
+ */
+int readers_init(readers_t* self, int num_threads, output_t* out,
+                 sizepool_t* names) {
+    readers_sync_t* sync;
+
+    memset(self, 0, sizeof(readers_t));
+    self->out = out;
+    self->names = names;
+    if (!(sync = malloc(sizeof(readers_sync_t))))
+        return -1;
+    self->sync = sync;
+    pthread_mutex_init(&sync->lock, NULL);
+    pthread_cond_init(&sync->work, NULL);
+    pthread_cond_init(&sync->finished, NULL);
+
+    if (num_threads > READERS_MAX)
+        num_threads = READERS_MAX;
+    while (self->num_threads < num_threads &&
+           !pthread_create(sync->threads + self->num_threads, NULL,
+                           readers_thread, self))
+        self->num_threads++;
+    if (!self->num_threads) {
+        readers_destroy(self);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * writes out what is left and stops the threads.
+ */
+void readers_destroy(readers_t* self) {
+    readers_sync_t* sync = self->sync;
+    int i;
+
+    if (!sync)
+        return;
+    readers_flush(self);
+    pthread_mutex_lock(&sync->lock);
+    self->stopping = 1;
+    pthread_cond_broadcast(&sync->work);
+    pthread_mutex_unlock(&sync->lock);
+    for (i = 0; i < self->num_threads; i++)
+        pthread_join(sync->threads[i], NULL);
+
+    pthread_mutex_destroy(&sync->lock);
+    pthread_cond_destroy(&sync->work);
+    pthread_cond_destroy(&sync->finished);
+    free(sync);
+    free(self->retired);
+    memset(self, 0, sizeof(readers_t));
+}
+
+/*
+ * a job with room for the given rows (and names), or NULL if there wasn't
+ * memory for it.
+ */
+readers_job_t* readers_job(char command, unsigned int num_rows,
+                           size_t row_size, unsigned int num_names) {
+    readers_job_t* job;
+    size_t size = row_size * num_rows + sizeof(char*) * num_names;
+
+    if (!(job = malloc(sizeof(readers_job_t))))
+        return NULL;
+    /* the names go after the rows, which are aligned for them too */
+    job->storage = (size) ? malloc(size) : NULL;
+    if ((size && !job->storage) || output_init(&job->out, NULL)) {
+        free(job->storage);
+        free(job);
+        return NULL;
+    }
+    job->command = command;
+    job->rows = job->storage;
+    job->num_rows = num_rows;
+    job->row_size = row_size;
+    job->names = (num_names) ? (const char**)((char*)job->storage +
+                                              row_size * num_rows)
+                             : NULL;
+    job->done = !command;
+    job->next = job->next_to_run = NULL;
+    return job;
+}
+
+/*
+ * splits off a part printing the first rows of the listing, which goes on
+ * with the rest. returns NULL if there wasn't memory for it.
+ */
+readers_job_t* readers_part(readers_job_t* job, unsigned int num_rows) {
+    readers_job_t* part;
+
+    if (!(part = malloc(sizeof(readers_job_t))))
+        return NULL;
+    if (output_init(&part->out, NULL)) {
+        free(part);
+        return NULL;
+    }
+    part->command = job->command;
+    part->rows = job->rows;
+    part->num_rows = num_rows;
+    part->row_size = job->row_size;
+    part->names = job->names;
+    part->storage = NULL;
+    part->done = 0;
+    part->next = part->next_to_run = NULL;
+
+    job->rows = (char*)job->rows + job->row_size * num_rows;
+    job->num_rows -= num_rows;
+    return part;
+}
+
+/*
+ * frees the job, with what it printed.
+ */
+void readers_free_job(readers_job_t* job) {
+    output_destroy(&job->out);
+    free(job->storage);
+    free(job);
+}
+
+/*
+ * puts the job at the end of the output.
+ */
+void readers_append(readers_t* self, readers_job_t* job) {
+    if (self->last)
+        self->last->next = job;
+    else
+        self->first = job;
+    self->last = job;
+}
+
+/*
+ * where the writer prints now: straight to the output if nothing is waiting
+ * to be written, or else after the last listing.
+ */
+output_t* readers_output(readers_t* self) {
+    readers_job_t* job;
+
+    if (!self->first)
+        return self->out;
+    if (!self->last->command)
+        return &self->last->out;
+    if (!(job = readers_job(0, 0, 0, 0))) {
+        /* without room for it, the listings are waited for */
+        readers_flush(self);
+        return self->out;
+    }
+    readers_append(self, job);
+    return &job->out;
+}
+
+/*
+ * puts a part of a listing in the output, and in the queue of the threads.
+ */
+void readers_queue(readers_t* self, readers_job_t* job) {
+    readers_sync_t* sync = self->sync;
+
+    readers_append(self, job);
+    self->submitted++;
+    pthread_mutex_lock(&sync->lock);
+    if (self->last_to_run)
+        self->last_to_run->next_to_run = job;
+    else
+        self->to_run = job;
+    self->last_to_run = job;
+    pthread_cond_signal(&sync->work);
+    pthread_mutex_unlock(&sync->lock);
+}
+
+/*
+ * hands the listing to the threads. it is written after everything printed
+ * before it, and before anything printed after it.
+ * a big one is split in parts (as many as there are threads, at most) to be
+ * printed at the same time.
+ */
+void readers_submit(readers_t* self, readers_job_t* job) {
+    readers_job_t* part;
+    unsigned int num_parts = job->num_rows / READERS_PART_ROWS;
+
+    if (num_parts > (unsigned int)self->num_threads)
+        num_parts = self->num_threads;
+    for (; num_parts > 1; num_parts--) {
+        if (!(part = readers_part(job, job->num_rows / num_parts)))
+            break;
+        readers_queue(self, part);
+    }
+    readers_queue(self, job);
+}
+
+/*
+ * frees the retired names no listing can still print.
+ */
+void readers_reclaim(readers_t* self, unsigned long printed) {
+    unsigned int i;
+
+    for (i = 0; i < self->num_retired && self->retired[i].jobs <= printed; i++)
+        sizepool_strfree(self->names, self->retired[i].name);
+    if (!i)
+        return;
+    self->num_retired -= i;
+    memmove(self->retired, self->retired + i,
+            sizeof(readers_retired_t) * self->num_retired);
+}
+
+/*
+ * writes the output, up to the first listing not printed yet.
+ */
+void readers_drain(readers_t* self) {
+    readers_job_t* job;
+    int done;
+
+    while ((job = self->first)) {
+        if (job->command) {
+            pthread_mutex_lock(&self->sync->lock);
+            done = job->done;
+            pthread_mutex_unlock(&self->sync->lock);
+            if (!done)
+                break;
+            self->printed++;
+        }
+        output_bytes(self->out, job->out.data, job->out.size);
+        if (!(self->first = job->next))
+            self->last = NULL;
+        readers_free_job(job);
+    }
+    if (self->num_retired)
+        readers_reclaim(self, self->printed);
+}
+
+/*
+ * waits for every listing and writes (and flushes) the whole output.
+ */
+void readers_flush(readers_t* self) {
+    readers_sync_t* sync = self->sync;
+
+    for (readers_drain(self); self->first; readers_drain(self)) {
+        pthread_mutex_lock(&sync->lock);
+        while (!self->first->done)
+            pthread_cond_wait(&sync->finished, &sync->lock);
+        pthread_mutex_unlock(&sync->lock);
+    }
+    output_flush(self->out);
+}
+
+/*
+ * waits for every listing to be printed (not written), after which no name
+ * is in use by the threads: the retired ones are freed.
+ */
+void readers_synchronize(readers_t* self) {
+    readers_sync_t* sync = self->sync;
+    readers_job_t* job;
+
+    pthread_mutex_lock(&sync->lock);
+    for (job = self->first; job; job = job->next)
+        while (!job->done)
+            pthread_cond_wait(&sync->finished, &sync->lock);
+    pthread_mutex_unlock(&sync->lock);
+    readers_reclaim(self, self->submitted);
+}
+
+/*
+ * frees a name dropped from the network once the listings submitted until
+ * now are printed (right away, if there are none).
+ */
+void readers_retire(readers_t* self, char* name) {
+    unsigned int capacity;
+    readers_retired_t* retired;
+
+    if (self->printed == self->submitted) {
+        sizepool_strfree(self->names, name);
+        return;
+    }
+    if (self->num_retired == self->retired_capacity) {
+        capacity = (self->retired_capacity) ? self->retired_capacity * 2 : 64;
+        if (!(retired = realloc(self->retired,
+                                sizeof(readers_retired_t) * capacity))) {
+            readers_synchronize(self);
+            sizepool_strfree(self->names, name);
+            return;
+        }
+        self->retired = retired;
+        self->retired_capacity = capacity;
+    }
+    self->retired[self->num_retired].name = name;
+    self->retired[self->num_retired++].jobs = self->submitted;
+}
@@ -0,0 +1,103 @@
+#ifndef READERS_HEADER
+#define READERS_HEADER
+
+#include "output.h"
+#include "pool.h"
+
+/* reader threads there can be */
+#define READERS_MAX 64
+/* rows a listing needs for each thread it is split between */
+#define READERS_PART_ROWS 4096
+
+/* a line, as the c command lists it */
+typedef struct {
+    const char* name;
+    const char* origin; /* NULL if it has no stops */
+    const char* destination;
+    int num_stops;
+    double total_cost;
+    double total_duration;
+} readers_line_t;
+
+/* a stop, as the p command lists it */
+typedef struct {
+    const char* name;
+    double latitude;
+    double longitude;
+    int num_lines;
+} readers_stop_t;
+
+/* an interchange, as the i command lists it, with its lines in a names array */
+typedef struct {
+    const char* name;
+    unsigned int first_line;
+    int num_lines;
+} readers_interchange_t;
+
+/*
+ * a listing, from a copy of what it lists (the names are shared with the
+ * network, which keeps them until the listing is printed).
+ * it is also a part of the output, in the order of the commands: the writer's
+ * own output between listings goes in parts with no rows, and a big listing is
+ * split in parts printing a run of its rows each (the last of which keeps the
+ * copy).
+ */
+typedef struct readers_job {
+    char command; /* 'c', 'p' or 'i', or 0 for the writer's output */
+    void* rows;
+    unsigned int num_rows;
+    size_t row_size;
+    const char** names; /* lines of the interchanges */
+    void* storage;      /* of the rows and names, if this part frees them */
+    output_t out;
+    int done;
+    struct readers_job* next;        /* in the output */
+    struct readers_job* next_to_run; /* in the queue of the threads */
+} readers_job_t;
+
+/* a name the network dropped, and the listings that may still print it */
+typedef struct {
+    char* name;
+    unsigned long jobs; /* submitted before it was dropped */
+} readers_retired_t;
+
+typedef struct readers_sync readers_sync_t;
+
+/*
+ * pool of threads printing listings while the single writer (the thread that
+ * reads the commands) goes on changing the network.
+ * the output is put back in order by the writer, which is the only one to
+ * write it, and to free the names the listings use, once they are printed.
+ */
+typedef struct {
+    readers_sync_t* sync; /* the threads, and what they share */
+    int num_threads;
+    readers_job_t* first; /* of the output still to be written */
+    readers_job_t* last;
+    readers_job_t* to_run;
+    readers_job_t* last_to_run;
+    unsigned long submitted; /* parts of listings */
+    unsigned long printed;
+    int stopping;
+    output_t* out;
+    sizepool_t* names; /* where the retired names go back to */
+    readers_retired_t* retired;
+    unsigned int num_retired;
+    unsigned int retired_capacity;
+} readers_t;
+
+int readers_init(readers_t* self, int num_threads, output_t* out,
+                 sizepool_t* names);
+void readers_destroy(readers_t* self);
+output_t* readers_output(readers_t* self);
+readers_job_t* readers_job(char command, unsigned int num_rows,
+                           size_t row_size, unsigned int num_names);
+void readers_submit(readers_t* self, readers_job_t* job);
+void readers_drain(readers_t* self);
+void readers_flush(readers_t* self);
+void readers_synchronize(readers_t* self);
+void readers_retire(readers_t* self, char* name);
+void readers_print_line(output_t* out, const readers_line_t* line);
+void readers_print_stop(output_t* out, const readers_stop_t* stop);
+
+#endif /* !READERS_HEADER */
@@ -0,0 +1,494 @@
+#include "route.h"
+#include "stats.h"
+
+/* no edge arrives at the origin of a search */
+#define ROUTE_NONE ((unsigned int)-1)
+
+void route_init(route_graph_t* self) { memset(self, 0, sizeof(route_graph_t)); }
+
+void route_destroy(route_graph_t* self) {
+    route_side_t* side;
+    int i;
+
+    for (i = 0; i < 2; i++) {
+        side = self->sides + i;
+        free(side->stamps);
+        free(side->keys);
+        free(side->ties);
+        free(side->via);
+        free(side->from);
+        free(side->done);
+        free(side->heap);
+    }
+    free(self->numbers);
+    free(self->ids);
+    free(self->components);
+    free(self->first_edge);
+    free(self->edges);
+    free(self->path);
+    free(self->path_stops);
+    route_init(self);
+}
+
+/*
+ * the links changed: the graph is built again by the next search.
+ */
+void route_invalidate(route_graph_t* self) { self->valid = 0; }
+
+/*
+ * reallocs the array, keeping it as it was if there is no memory for it (and
+ * saying so in failed).
+ */
+__always_inline void* route_grow(void* array, size_t size, int* failed) {
+    void* new = realloc(array, size);
+    if (!new) {
+        *failed = 1;
+        return array;
+    }
+    return new;
+}
+
+/*
+ * makes room for the given number of stops in every per-stop array.
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int route_reserve_stops(route_graph_t* self, unsigned int num_stops) {
+    unsigned int capacity = (self->capacity) ? self->capacity : 64;
+    route_side_t* side;
+    int i, failed = 0;
+
+    if (num_stops < self->capacity)
+        return 0;
+    while (capacity <= num_stops)
+        capacity *= 2;
+
+    self->numbers =
+        route_grow(self->numbers, sizeof(unsigned int) * capacity, &failed);
+    self->ids =
+        route_grow(self->ids, sizeof(unsigned int) * capacity, &failed);
+    self->components = route_grow(self->components,
+                                  sizeof(unsigned int) * capacity, &failed);
+    self->first_edge = route_grow(
+        self->first_edge, sizeof(unsigned int) * (capacity + 1), &failed);
+    self->path =
+        route_grow(self->path, sizeof(unsigned int) * capacity, &failed);
+    self->path_stops = route_grow(self->path_stops,
+                                  sizeof(unsigned int) * capacity, &failed);
+    for (i = 0; i < 2; i++) {
+        side = self->sides + i;
+        side->stamps = route_grow(side->stamps,
+                                  sizeof(unsigned int) * capacity, &failed);
+        side->keys = route_grow(side->keys, sizeof(double) * capacity, &failed);
+        side->ties = route_grow(side->ties, sizeof(double) * capacity, &failed);
+        side->via = route_grow(side->via, sizeof(unsigned int) * capacity,
+                               &failed);
+        side->from = route_grow(side->from, sizeof(unsigned int) * capacity,
+                                &failed);
+        side->done = route_grow(side->done, capacity, &failed);
+    }
+    if (failed)
+        return -1;
+
+    /* the stamps of the new places can't be left at random */
+    for (i = 0; i < 2; i++)
+        memset(self->sides[i].stamps, 0, sizeof(unsigned int) * capacity);
+    self->stamp = 0;
+    self->capacity = capacity;
+    return 0;
+}
+
+/*
+ * adds an edge to the stop's list, at the place its cursor is at.
+ */
+__always_inline void route_add_edge(route_graph_t* self,
+                                    unsigned int* cursors, unsigned int from,
+                                    unsigned int to, unsigned int line,
+                                    double cost, double duration) {
+    route_edge_t* edge = self->edges + cursors[from]++;
+    edge->to = to;
+    edge->line = line;
+    edge->cost = cost;
+    edge->duration = duration;
+}
+
+/*
+ * numbers the stops by the part of the network they are in (a breadth first
+ * search from each stop not numbered yet), so searches between parts that
+ * aren't connected end right away.
+ */
+void route_find_components(route_graph_t* self) {
+    unsigned int* queue = self->path_stops;
+    unsigned int first, i, head, tail, stop, num_components = 0;
+
+    for (i = 0; i < self->num_stops; i++)
+        self->components[i] = ROUTE_NONE;
+    for (first = 0; first < self->num_stops; first++) {
+        if (self->components[first] != ROUTE_NONE)
+            continue;
+        self->components[first] = num_components;
+        queue[0] = first;
+        for (head = 0, tail = 1; head < tail; head++) {
+            stop = queue[head];
+            for (i = self->first_edge[stop]; i < self->first_edge[stop + 1];
+                 i++)
+                if (self->components[self->edges[i].to] == ROUTE_NONE) {
+                    self->components[self->edges[i].to] = num_components;
+                    queue[tail++] = self->edges[i].to;
+                }
+        }
+        num_components++;
+    }
+}
+
+/*
+ * numbers the stops in the order they are listed.
+ */
+void route_number_stops(route_graph_t* self, const stop_table_t* stops) {
+    unsigned int i, id;
+
+    self->num_ids = stops->size;
+    self->num_stops = 0;
+    for (i = 0; i < self->num_ids; i++)
+        self->numbers[i] = ROUTE_NONE;
+    for (i = 0; i < stops->listing_size; i++)
+        if ((id = stops->listing[i]) != NO_STOP) {
+            self->numbers[id] = self->num_stops;
+            self->ids[self->num_stops++] = id;
+        }
+}
+
+/*
+ * builds the adjacency arrays: every link of every line gives an edge each way
+ * (loops at a single stop are of no use to a path, so they are left out).
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int route_build(route_graph_t* self, const stop_table_t* stops, lht_t* lines) {
+    line_t* line;
+    lht_iterator_t iterator;
+    const line_stop_t *current, *end;
+    unsigned int i, from, to, num_edges = 0;
+    unsigned int *cursors, *numbers;
+    route_edge_t* edges;
+
+    if (route_reserve_stops(self, stops->size))
+        return -1;
+    route_number_stops(self, stops);
+    numbers = self->numbers;
+
+    /* how many edges each stop has, and so where its edges start */
+    cursors = self->sides[0].via;
+    memset(cursors, 0, sizeof(unsigned int) * self->num_stops);
+    for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+         (line = lht_iterator_next(&iterator));) {
+        end = line->stops + line->first + line->num_stops;
+        for (current = line->stops + line->first; end - current > 1; current++)
+            if (current->stop != current[1].stop) {
+                cursors[numbers[current->stop]]++;
+                cursors[numbers[current[1].stop]]++;
+                num_edges += 2;
+            }
+    }
+    self->first_edge[0] = 0;
+    for (i = 0; i < self->num_stops; i++) {
+        self->first_edge[i + 1] = self->first_edge[i] + cursors[i];
+        cursors[i] = self->first_edge[i];
+    }
+
+    if (num_edges > self->edges_capacity) {
+        if (!(edges = realloc(self->edges, sizeof(route_edge_t) * num_edges)))
+            return -1;
+        self->edges = edges;
+        self->edges_capacity = num_edges;
+    }
+    self->num_edges = num_edges;
+    for (lht_iterator_init(&iterator, lines, LHT_PREFETCH_VALUES);
+         (line = lht_iterator_next(&iterator));) {
+        end = line->stops + line->first + line->num_stops;
+        for (current = line->stops + line->first; end - current > 1; current++)
+            if (current->stop != current[1].stop) {
+                from = numbers[current->stop];
+                to = numbers[current[1].stop];
+                route_add_edge(self, cursors, from, to, line->id,
+                               current[1].cost, current[1].duration);
+                route_add_edge(self, cursors, to, from, line->id,
+                               current[1].cost, current[1].duration);
+            }
+    }
+
+    route_find_components(self);
+    self->valid = 1;
+    return 0;
+}
+
+/*
+ * whether a path of the first length (and other measure) is better than one
+ * of the second.
+ */
+__always_inline int route_shorter(double key, double tie, double other_key,
+                                  double other_tie) {
+    return key < other_key || (key == other_key && tie < other_tie);
+}
+
+/*
+ * whether the first heap item comes out before the second.
+ */
+__always_inline int route_heap_before(const route_heap_item_t* a,
+                                      const route_heap_item_t* b) {
+    if (a->key != b->key || a->tie != b->tie)
+        return route_shorter(a->key, a->tie, b->key, b->tie);
+    return a->stop < b->stop;
+}
+
+/*
+ * pushes a stop into the (binary, min) heap of the side.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int route_heap_push(route_side_t* side, double key, double tie,
+                    unsigned int stop) {
+    route_heap_item_t item, *heap;
+    unsigned int i, parent, capacity;
+
+    if (side->heap_size == side->heap_capacity) {
+        capacity = (side->heap_capacity) ? side->heap_capacity * 2 : 64;
+        if (!(heap = realloc(side->heap, sizeof(route_heap_item_t) * capacity)))
+            return -1;
+        side->heap = heap;
+        side->heap_capacity = capacity;
+    }
+
+    item.key = key;
+    item.tie = tie;
+    item.stop = stop;
+    for (i = side->heap_size++; i; i = parent) {
+        parent = (i - 1) / 2;
+        if (!route_heap_before(&item, side->heap + parent))
+            break;
+        side->heap[i] = side->heap[parent];
+    }
+    side->heap[i] = item;
+    return 0;
+}
+
+/*
+ * takes the first stop out of the heap of the side.
+ */
+route_heap_item_t route_heap_pop(route_side_t* side) {
+    route_heap_item_t first = side->heap[0];
+    route_heap_item_t last = side->heap[--side->heap_size];
+    unsigned int i = 0, child;
+
+    while ((child = 2 * i + 1) < side->heap_size) {
+        if (child + 1 < side->heap_size &&
+            route_heap_before(side->heap + child + 1, side->heap + child))
+            child++;
+        if (!route_heap_before(side->heap + child, &last))
+            break;
+        side->heap[i] = side->heap[child];
+        i = child;
+    }
+    if (side->heap_size)
+        side->heap[i] = last;
+    return first;
+}
+
+/*
+ * the side reaches the stop (again, if it was already reached, closer).
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+__always_inline int route_reach(route_graph_t* self, route_side_t* side,
+                                unsigned int stop, double key, double tie,
+                                unsigned int via, unsigned int from) {
+    side->stamps[stop] = self->stamp;
+    side->done[stop] = 0;
+    side->keys[stop] = key;
+    side->ties[stop] = tie;
+    side->via[stop] = via;
+    side->from[stop] = from;
+    return route_heap_push(side, key, tie, stop);
+}
+
+/*
+ * bidirectional dijkstra: a search from each end, always going on with the
+ * side with the fewest stops waiting, until nothing either of them has left
+ * can be part of a path better than the best one where they met.
+ * paths are compared by cost (or duration) and then by the other one.
+ * returns 1 if there is a path (and where it was met), 0 if there isn't, -1 if
+ * there wasn't memory.
+ */
+int route_search(route_graph_t* self, unsigned int origin,
+                 unsigned int destination, int by_duration,
+                 unsigned int* meeting) {
+    route_side_t *side, *other;
+    route_heap_item_t item;
+    const route_edge_t* edge;
+    unsigned int i, to;
+    double key, tie, best_key = 0, best_tie = 0;
+    int found = 0;
+
+    /* a new stamp makes every stop unreached, without touching them */
+    if (!++self->stamp) {
+        for (i = 0; i < 2; i++)
+            memset(self->sides[i].stamps, 0,
+                   sizeof(unsigned int) * self->capacity);
+        self->stamp = 1;
+    }
+    self->sides[0].heap_size = self->sides[1].heap_size = 0;
+    if (route_reach(self, self->sides, origin, 0, 0, ROUTE_NONE, ROUTE_NONE) ||
+        route_reach(self, self->sides + 1, destination, 0, 0, ROUTE_NONE,
+                    ROUTE_NONE))
+        return -1;
+
+    while (self->sides[0].heap_size && self->sides[1].heap_size) {
+        if (found && !route_shorter(self->sides[0].heap->key +
+                                        self->sides[1].heap->key,
+                                    self->sides[0].heap->tie +
+                                        self->sides[1].heap->tie,
+                                    best_key, best_tie))
+            break;
+        i = self->sides[0].heap_size > self->sides[1].heap_size;
+        side = self->sides + i;
+        other = self->sides + !i;
+
+        item = route_heap_pop(side);
+        if (side->done[item.stop])
+            continue;
+        side->done[item.stop] = 1;
+        STATS_ADD(STATS_ROUTE_VISITS, 1);
+
+        for (i = self->first_edge[item.stop];
+             i < self->first_edge[item.stop + 1]; i++) {
+            edge = self->edges + i;
+            to = edge->to;
+            key = item.key + ((by_duration) ? edge->duration : edge->cost);
+            tie = item.tie + ((by_duration) ? edge->cost : edge->duration);
+            if (side->stamps[to] == self->stamp &&
+                (side->done[to] ||
+                 !route_shorter(key, tie, side->keys[to], side->ties[to])))
+                continue;
+            if (route_reach(self, side, to, key, tie, i, item.stop))
+                return -1;
+
+            /* the other side has been here: that's a path */
+            if (other->stamps[to] == self->stamp &&
+                (!found || route_shorter(key + other->keys[to],
+                                         tie + other->ties[to], best_key,
+                                         best_tie))) {
+                best_key = key + other->keys[to];
+                best_tie = tie + other->ties[to];
+                *meeting = to;
+                found = 1;
+            }
+        }
+    }
+    return found;
+}
+
+/*
+ * puts the path found, through the stop where the sides met, in order.
+ * returns the number of edges in it.
+ */
+unsigned int route_path(route_graph_t* self, unsigned int origin,
+                        unsigned int destination, unsigned int meeting) {
+    const route_side_t* forward = self->sides;
+    const route_side_t* backward = self->sides + 1;
+    unsigned int length = 0, i, stop;
+
+    for (stop = meeting; stop != origin; stop = forward->from[stop])
+        length++;
+    self->path_stops[i = length] = meeting;
+    for (stop = meeting; stop != origin; stop = forward->from[stop]) {
+        self->path[--i] = forward->via[stop];
+        self->path_stops[i] = forward->from[stop];
+    }
+    for (stop = meeting; stop != destination; stop = backward->from[stop]) {
+        self->path[length] = backward->via[stop];
+        self->path_stops[++length] = backward->from[stop];
+    }
+    return length;
+}
+
+/*
+ * prints the path found: the stops at its ends, the number of legs (stretches
+ * along a single line), its cost and duration (summed from the origin), and
+ * then each leg, as its line and the stops where it is taken and left.
+ */
+void route_print(route_graph_t* self, const stop_table_t* stops,
+                 line_t** line_ids, unsigned int length, output_t* out) {
+    unsigned int legs = 0, i, start = 0;
+    double cost = 0, duration = 0;
+    const route_edge_t* edge;
+
+    for (i = 0; i < length; i++) {
+        edge = self->edges + self->path[i];
+        cost += edge->cost;
+        duration += edge->duration;
+        if (!i || edge->line != self->edges[self->path[i - 1]].line)
+            legs++;
+    }
+
+    output_string(out, stops->names[self->ids[self->path_stops[0]]]);
+    output_char(out, ' ');
+    output_string(out, stops->names[self->ids[self->path_stops[length]]]);
+    output_char(out, ' ');
+    output_int(out, legs);
+    output_char(out, ' ');
+    output_fixed(out, cost, 0, 2);
+    output_char(out, ' ');
+    output_fixed(out, duration, 0, 2);
+    output_char(out, '\n');
+
+    for (i = 0; i < length; i++) {
+        edge = self->edges + self->path[i];
+        if (i + 1 < length && self->edges[self->path[i + 1]].line == edge->line)
+            continue;
+        output_string(out, line_ids[edge->line]->name);
+        output_char(out, ' ');
+        output_string(out, stops->names[self->ids[self->path_stops[start]]]);
+        output_char(out, ' ');
+        output_string(out, stops->names[self->ids[self->path_stops[i + 1]]]);
+        output_char(out, '\n');
+        start = i + 1;
+    }
+}
+
+/*
+ * t command (the search itself).
+ * prints the cheapest (or quickest) path between the two stops (given by id),
+ * building the graph first if the links changed since the last search.
+ * stops added since then (not numbered in it) have no links.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int route_find(route_graph_t* self, const stop_table_t* stops, lht_t* lines,
+               line_t** line_ids, unsigned int origin,
+               unsigned int destination, int by_duration, output_t* out) {
+    unsigned int meeting = 0;
+    int found;
+
+    if (origin == destination) {
+        output_string(out, stops->names[origin]);
+        output_char(out, ' ');
+        output_string(out, stops->names[destination]);
+        output_string(out, " 0 0.00 0.00\n");
+        return 0;
+    }
+
+    if (!self->valid && route_build(self, stops, lines))
+        return -1;
+    origin = (origin < self->num_ids) ? self->numbers[origin] : ROUTE_NONE;
+    destination = (destination < self->num_ids) ? self->numbers[destination]
+                                                : ROUTE_NONE;
+    if (origin == ROUTE_NONE || destination == ROUTE_NONE ||
+        self->components[origin] != self->components[destination])
+        found = 0;
+    else if ((found = route_search(self, origin, destination, by_duration,
+                                   &meeting)) < 0)
+        return -1;
+
+    if (!found) {
+        output_string(out, "no route.\n");
+        return 0;
+    }
+    route_print(self, stops, line_ids,
+                route_path(self, origin, destination, meeting), out);
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef ROUTE_HEADER
+#define ROUTE_HEADER
+
+#include "linked-hash-table.h"
+#include "main.h"
+#include "output.h"
+#include "stop-table.h"
+
+/* a link of a line, from the stop it is listed under */
+typedef struct {
+    unsigned int to;
+    unsigned int line; /* id */
+    double cost;
+    double duration;
+} route_edge_t;
+
+/* a stop waiting in the heap, with the length of the path to it */
+typedef struct {
+    double key;
+    double tie; /* the other measure, for paths just as long */
+    unsigned int stop;
+} route_heap_item_t;
+
+/* one end of a search, and how far each stop it reached is from that end */
+typedef struct {
+    /* per stop, only meaningful when its stamp is the current search's */
+    unsigned int* stamps;
+    double* keys;
+    double* ties;
+    unsigned int* via; /* edge it was reached by (in the list of from) */
+    unsigned int* from;
+    unsigned char* done;
+    route_heap_item_t* heap;
+    unsigned int heap_size;
+    unsigned int heap_capacity;
+} route_side_t;
+
+/*
+ * adjacency arrays of the network (each link goes both ways, as lines can be
+ * taken in either direction), and what a search needs, kept between searches.
+ * the stops are numbered as they are listed, not by id: paths just as long
+ * are told apart by those numbers, which don't change when ids are given
+ * again, or packed by a snapshot.
+ * it is built on demand and thrown away by anything that changes the links.
+ */
+typedef struct {
+    int valid;
+    unsigned int num_stops; /* numbered when it was built */
+    unsigned int num_ids;   /* ids given then */
+    unsigned int* numbers;  /* of the stops, by id */
+    unsigned int* ids;      /* of the stops, by number */
+    unsigned int* components; /* stops with a path between them share it */
+    unsigned int* first_edge; /* the edges of stop i end at first_edge[i + 1] */
+    route_edge_t* edges;
+    unsigned int num_edges;
+    unsigned int capacity; /* of the per-stop arrays */
+    unsigned int edges_capacity;
+    unsigned int stamp;
+    route_side_t sides[2]; /* from the origin and from the destination */
+    unsigned int* path; /* edges of the path found, in order */
+    unsigned int* path_stops; /* and the stops they go through */
+} route_graph_t;
+
+void route_init(route_graph_t* self);
+void route_destroy(route_graph_t* self);
+void route_invalidate(route_graph_t* self);
+int route_find(route_graph_t* self, const stop_table_t* stops, lht_t* lines,
+               line_t** line_ids, unsigned int origin,
+               unsigned int destination, int by_duration, output_t* out);
+
+#endif /* !ROUTE_HEADER */
@@ -0,0 +1,324 @@
+#define _GNU_SOURCE
+#include "server.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/*
+ * the output of the client not sent yet.
+ */
+__always_inline size_t server_pending(const server_client_t* client) {
+    return client->out.size - client->sent;
+}
+
+/*
+ * adds the file to the ones epoll waits on, for reading.
+ * returns 0 if ok, -1 otherwise.
+ */
+int server_watch(server_t* self, int fd, void* data) {
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.ptr = data;
+    return epoll_ctl(self->epoll, EPOLL_CTL_ADD, fd, &event);
+}
+
+/*
+ * creates the socket at the given path and gets ready to serve it.
+ * returns 0 if ok, -1 otherwise (with nothing left behind).
+ */
+int server_init(server_t* self, const char* path, server_command_t command,
+                server_ended_t ended, void* context) {
+    struct sockaddr_un address;
+    struct stat info;
+    sigset_t signals;
+
+    memset(self, 0, sizeof(server_t));
+    self->listener = self->epoll = self->signals = -1;
+    self->path = path;
+    self->command = command;
+    self->ended = ended;
+    self->context = context;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+        return -1;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    /* a socket left behind by an earlier server (but nothing else) goes */
+    if (!stat(path, &info) && S_ISSOCK(info.st_mode))
+        unlink(path);
+
+    if ((self->listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK |
+                                              SOCK_CLOEXEC,
+                                 0)) < 0 ||
+        bind(self->listener, (struct sockaddr*)&address, sizeof(address))) {
+        server_destroy(self);
+        return -1;
+    }
+    self->bound = 1;
+
+    /* the signals are taken as events, so the loop can end cleanly */
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    if (listen(self->listener, SOMAXCONN) ||
+        sigprocmask(SIG_BLOCK, &signals, NULL) ||
+        (self->signals = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) <
+            0 ||
+        (self->epoll = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        server_watch(self, self->listener, &self->listener) ||
+        server_watch(self, self->signals, &self->signals)) {
+        server_destroy(self);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * ends the session of the client: no more of its commands are run.
+ */
+void server_end(server_t* self, server_client_t* client) {
+    client->closing = 1;
+    if (self->ended)
+        self->ended(self->context, client);
+}
+
+/*
+ * closes the connection and frees the client.
+ */
+void server_close(server_t* self, server_client_t* client) {
+    if (!client->closing)
+        server_end(self, client);
+    if (client->previous)
+        client->previous->next = client->next;
+    else
+        self->clients = client->next;
+    if (client->next)
+        client->next->previous = client->previous;
+    close(client->fd); /* which takes it out of epoll too */
+    output_destroy(&client->out);
+    free(client->data);
+    free(client);
+}
+
+/*
+ * closes every connection and the socket (removing its file).
+ */
+void server_destroy(server_t* self) {
+    while (self->clients)
+        server_close(self, self->clients);
+    if (self->epoll >= 0)
+        close(self->epoll);
+    if (self->signals >= 0)
+        close(self->signals);
+    if (self->listener >= 0)
+        close(self->listener);
+    if (self->bound)
+        unlink(self->path);
+    self->listener = self->epoll = self->signals = -1;
+    self->bound = 0;
+}
+
+/*
+ * takes in the connections waiting on the socket.
+ * one that there isn't memory for is just closed.
+ */
+void server_accept(server_t* self) {
+    server_client_t* client;
+    int fd;
+
+    while ((fd = accept4(self->listener, NULL, NULL,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        if (!(client = malloc(sizeof(server_client_t)))) {
+            close(fd);
+            continue;
+        }
+        memset(client, 0, sizeof(server_client_t));
+        client->fd = fd;
+        client->capacity = SERVER_BLOCK_SIZE;
+        if (!(client->data = malloc(client->capacity)) ||
+            output_init(&client->out, NULL) ||
+            server_watch(self, fd, client)) {
+            free(client->data);
+            free(client);
+            close(fd);
+            continue;
+        }
+        client->events = EPOLLIN;
+        if ((client->next = self->clients))
+            client->next->previous = client;
+        self->clients = client;
+    }
+}
+
+/*
+ * reads what the client sent, after the bytes not given out yet (which are
+ * moved to the start of the buffer first).
+ */
+void server_read(server_client_t* client) {
+    char* data;
+    ssize_t count;
+
+    if (client->position) {
+        client->size -= client->position;
+        memmove(client->data, client->data + client->position, client->size);
+        client->position = 0;
+    }
+    /* there has to be room for the '\0' after the last line */
+    if (client->capacity - client->size < SERVER_BLOCK_SIZE / 2) {
+        if (!(data = realloc(client->data, client->capacity * 2))) {
+            client->broken = 1;
+            return;
+        }
+        client->data = data;
+        client->capacity *= 2;
+    }
+
+    count = read(client->fd, client->data + client->size,
+                 client->capacity - client->size - 1);
+    if (count > 0)
+        client->size += (size_t)count;
+    else if (!count)
+        client->eof = 1;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        client->broken = 1;
+}
+
+/*
+ * gives out the next whole line the client sent, without its newline and
+ * terminated by a '\0' (the last one may have no newline, once the client is
+ * done). returns NULL if there is none yet.
+ */
+char* server_line(server_client_t* client, size_t* length) {
+    char *line = client->data + client->position, *end;
+    size_t size;
+
+    end = memchr(line + client->scanned, '\n',
+                 client->size - client->position - client->scanned);
+    if (end) {
+        size = (size_t)(end - line);
+        client->position += size + 1;
+    } else {
+        client->scanned = client->size - client->position;
+        if (!client->eof || !(size = client->scanned))
+            return NULL;
+        client->position = client->size;
+        end = line + size;
+    }
+    *end = '\0';
+    client->scanned = 0;
+    *length = size;
+    return line;
+}
+
+/*
+ * runs the commands the client sent, until its output is too far behind.
+ * returns 1 if that is why it stopped, 0 if there are no more commands.
+ */
+int server_serve(server_t* self, server_client_t* client) {
+    char* line;
+    size_t length;
+
+    while (!client->closing) {
+        if (server_pending(client) >= SERVER_MAX_PENDING)
+            return 1;
+        if (!(line = server_line(client, &length))) {
+            if (client->eof)
+                server_end(self, client);
+            break;
+        }
+        if (self->command(self->context, client, line, length))
+            server_end(self, client);
+    }
+    return 0;
+}
+
+/*
+ * sends as much of the output as the connection takes.
+ */
+void server_send(server_client_t* client) {
+    ssize_t count;
+
+    while (server_pending(client)) {
+        count = send(client->fd, client->out.data + client->sent,
+                     server_pending(client), MSG_NOSIGNAL);
+        if (count >= 0)
+            client->sent += (size_t)count;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        else if (errno != EINTR) {
+            client->broken = 1;
+            return;
+        }
+    }
+    client->out.size = client->sent = 0;
+}
+
+/*
+ * handles what epoll reported on the client: reads it, runs its commands and
+ * sends their output, and then waits for whatever it can go on with.
+ */
+void server_handle(server_t* self, server_client_t* client,
+                   unsigned int events) {
+    struct epoll_event event;
+    int blocked;
+
+    if (events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        server_read(client);
+    do {
+        blocked = server_serve(self, client);
+        server_send(client);
+    } while (blocked && !client->broken &&
+             server_pending(client) < SERVER_MAX_PENDING);
+
+    if (client->broken || (client->closing && !server_pending(client))) {
+        server_close(self, client);
+        return;
+    }
+    event.events = 0;
+    if (!client->closing && server_pending(client) < SERVER_MAX_PENDING)
+        event.events |= EPOLLIN;
+    if (server_pending(client))
+        event.events |= EPOLLOUT;
+    if (event.events != client->events) {
+        event.data.ptr = client;
+        if (epoll_ctl(self->epoll, EPOLL_CTL_MOD, client->fd, &event)) {
+            server_close(self, client);
+            return;
+        }
+        client->events = event.events;
+    }
+}
+
+/*
+ * serves the clients until the process is told to stop.
+ * returns 0 if it was, -1 if epoll failed.
+ */
+int server_run(server_t* self) {
+    struct epoll_event events[SERVER_EVENTS];
+    int count, i;
+
+    for (;;) {
+        if ((count = epoll_wait(self->epoll, events, SERVER_EVENTS, -1)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        for (i = 0; i < count; i++)
+            if (events[i].data.ptr == &self->signals)
+                return 0;
+            else if (events[i].data.ptr == &self->listener)
+                server_accept(self);
+            else
+                server_handle(self, events[i].data.ptr, events[i].events);
+    }
+}
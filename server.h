@@ -0,0 +1,66 @@
+#ifndef SERVER_HEADER
+#define SERVER_HEADER
+#include <stddef.h>
+
+#include "output.h"
+
+/* bytes asked from a client with each read */
+#define SERVER_BLOCK_SIZE 65536
+/* output a client can have waiting before its commands stop being run */
+#define SERVER_MAX_PENDING (1 << 20)
+/* events taken from epoll at a time */
+#define SERVER_EVENTS 64
+
+/*
+ * a connection to the server, with its own input (cut into lines in place, as
+ * the standard input is) and its own output.
+ */
+typedef struct server_client {
+    int fd;
+    char* data;
+    size_t size;     /* bytes of data holding input */
+    size_t capacity; /* always bigger than size */
+    size_t position; /* first byte not given out yet */
+    size_t scanned;  /* bytes after position known not to be a newline */
+    int eof;         /* the client won't send any more */
+    int closing;     /* no more commands are run, the output is just sent */
+    int broken;      /* the connection failed: it is closed right away */
+    unsigned int events; /* what epoll waits for */
+    output_t out;
+    size_t sent; /* bytes of the output already sent */
+    struct server_client* previous;
+    struct server_client* next;
+} server_client_t;
+
+/* runs a command of the client: anything but 0 ends its session */
+typedef int (*server_command_t)(void* context, server_client_t* client,
+                                char* line, size_t length);
+/* told when the session of a client ends (its output is still sent after) */
+typedef void (*server_ended_t)(void* context, server_client_t* client);
+
+/*
+ * event loop (with epoll) serving the clients of a unix domain socket.
+ * each client sends commands, one per line, and gets its output in the order
+ * it sent them: a client may send many commands without waiting for the
+ * output, which is then kept until it is read (up to a point, after which its
+ * commands wait too).
+ * the loop runs until the process gets SIGINT or SIGTERM.
+ */
+typedef struct {
+    int listener;
+    int epoll;
+    int signals; /* SIGINT and SIGTERM, as a file */
+    const char* path;
+    int bound; /* the socket file was created, and is removed at the end */
+    server_command_t command;
+    server_ended_t ended;
+    void* context; /* given to command and ended */
+    server_client_t* clients;
+} server_t;
+
+int server_init(server_t* self, const char* path, server_command_t command,
+                server_ended_t ended, void* context);
+void server_destroy(server_t* self);
+int server_run(server_t* self);
+
+#endif /* !SERVER_HEADER */
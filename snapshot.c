@@ -0,0 +1,267 @@
+#define _POSIX_C_SOURCE 200112L
+#include "snapshot.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* every section starts aligned for its doubles */
+#define SNAPSHOT_ALIGN(offset) (((offset) + 7) & ~7UL)
+/* the biggest snapshot its offsets can address */
+#define SNAPSHOT_MAX_SIZE 0xffffffffUL
+
+/*
+ * writes the bytes where the snapshot is at.
+ * returns 0 if ok, -1 if the writing failed.
+ */
+int snapshot_write(snapshot_writer_t* self, const void* bytes, size_t size) {
+    if (fwrite(bytes, 1, size, self->file) != size)
+        return -1;
+    self->position += size;
+    return 0;
+}
+
+/*
+ * writes zeros up to the given offset (the start of the next section).
+ * returns 0 if ok, -1 if the writing failed.
+ */
+int snapshot_pad(snapshot_writer_t* self, unsigned long offset) {
+    while (self->position < offset) {
+        if (fputc(0, self->file) == EOF)
+            return -1;
+        self->position++;
+    }
+    return 0;
+}
+
+/*
+ * creates the file and writes the header of a snapshot with the given sizes.
+ * returns 0 if ok, -1 if the file couldn't be written or would be too big.
+ */
+int snapshot_begin(snapshot_writer_t* self, const char* path,
+                   unsigned long num_stops, unsigned long num_lines,
+                   unsigned long num_nodes, unsigned long names_size) {
+    snapshot_header_t* header = &self->header;
+    double end;
+
+    /* in double, so none of this overflows */
+    end = SNAPSHOT_ALIGN(sizeof(snapshot_header_t)) +
+          ((double)num_stops + 1) * sizeof(snapshot_stop_t) +
+          ((double)num_lines + 1) * sizeof(snapshot_line_t) +
+          ((double)num_nodes + 1) * sizeof(snapshot_node_t) + names_size;
+    if (end > SNAPSHOT_MAX_SIZE)
+        return -1;
+
+    memset(header, 0, sizeof(snapshot_header_t));
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header->version = SNAPSHOT_VERSION;
+    header->byte_order = SNAPSHOT_BYTE_ORDER;
+    header->stop_size = sizeof(snapshot_stop_t);
+    header->line_size = sizeof(snapshot_line_t);
+    header->node_size = sizeof(snapshot_node_t);
+    header->num_stops = num_stops;
+    header->num_lines = num_lines;
+    header->num_nodes = num_nodes;
+    header->names_size = names_size;
+    header->stops_offset = SNAPSHOT_ALIGN(sizeof(snapshot_header_t));
+    header->lines_offset = SNAPSHOT_ALIGN(header->stops_offset +
+                                          num_stops * sizeof(snapshot_stop_t));
+    header->nodes_offset = SNAPSHOT_ALIGN(header->lines_offset +
+                                          num_lines * sizeof(snapshot_line_t));
+    header->names_offset = SNAPSHOT_ALIGN(header->nodes_offset +
+                                          num_nodes * sizeof(snapshot_node_t));
+    self->names_size = 0;
+    self->position = 0;
+
+    if (!(self->file = fopen(path, "wb")))
+        return -1;
+    if (snapshot_write(self, header, sizeof(snapshot_header_t))) {
+        fclose(self->file);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * adds a stop. its name takes the next place in the names.
+ * returns 0 if ok, -1 if the writing failed.
+ */
+int snapshot_stop(snapshot_writer_t* self, double latitude, double longitude,
+                  const char* name) {
+    snapshot_stop_t stop;
+
+    memset(&stop, 0, sizeof(stop));
+    stop.latitude = latitude;
+    stop.longitude = longitude;
+    stop.name = self->names_size;
+    self->names_size += strlen(name) + 1;
+    if (snapshot_pad(self, self->header.stops_offset))
+        return -1;
+    return snapshot_write(self, &stop, sizeof(stop));
+}
+
+/*
+ * adds a line, after the stops. its name takes the next place in the names.
+ * returns 0 if ok, -1 if the writing failed.
+ */
+int snapshot_line(snapshot_writer_t* self, double total_cost,
+                  double total_duration, const char* name,
+                  unsigned long first_node, unsigned long num_stops) {
+    snapshot_line_t line;
+
+    memset(&line, 0, sizeof(line));
+    line.total_cost = total_cost;
+    line.total_duration = total_duration;
+    line.name = self->names_size;
+    line.first_node = first_node;
+    line.num_stops = num_stops;
+    self->names_size += strlen(name) + 1;
+    if (snapshot_pad(self, self->header.lines_offset))
+        return -1;
+    return snapshot_write(self, &line, sizeof(line));
+}
+
+/*
+ * adds a node, after the lines.
+ * returns 0 if ok, -1 if the writing failed.
+ */
+int snapshot_node(snapshot_writer_t* self, double cost, double duration,
+                  unsigned long stop) {
+    snapshot_node_t node;
+
+    memset(&node, 0, sizeof(node));
+    node.cost = cost;
+    node.duration = duration;
+    node.stop = stop;
+    if (snapshot_pad(self, self->header.nodes_offset))
+        return -1;
+    return snapshot_write(self, &node, sizeof(node));
+}
+
+/*
+ * adds a name, after the nodes. they must come in the same order as their
+ * stops and lines.
+ * returns 0 if ok, -1 if the writing failed.
+ */
+int snapshot_name(snapshot_writer_t* self, const char* name) {
+    if (snapshot_pad(self, self->header.names_offset))
+        return -1;
+    return snapshot_write(self, name, strlen(name) + 1);
+}
+
+/*
+ * finishes the snapshot.
+ * returns 0 if ok, -1 if the writing failed (or didn't match the header).
+ */
+int snapshot_end(snapshot_writer_t* self) {
+    int failed = snapshot_pad(self, self->header.names_offset) ||
+                 self->names_size != self->header.names_size ||
+                 self->position !=
+                     self->header.names_offset + self->header.names_size;
+    if (fclose(self->file))
+        failed = 1;
+    return (failed) ? -1 : 0;
+}
+
+/*
+ * whether count records of the given size fit in the file at the offset.
+ */
+int snapshot_fits(const snapshot_t* self, unsigned long offset,
+                  unsigned long count, unsigned long size) {
+    return offset <= self->size && !(offset % 8) &&
+           count <= (self->size - offset) / size;
+}
+
+/*
+ * checks the header and every index and offset in the snapshot, so it can be
+ * read without any more checks.
+ * returns 0 if ok, -1 otherwise.
+ */
+int snapshot_check(snapshot_t* self) {
+    const snapshot_header_t* header = self->header;
+    unsigned long i;
+
+    if (self->size < sizeof(snapshot_header_t) ||
+        memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) ||
+        header->version != SNAPSHOT_VERSION ||
+        header->byte_order != SNAPSHOT_BYTE_ORDER ||
+        header->stop_size != sizeof(snapshot_stop_t) ||
+        header->line_size != sizeof(snapshot_line_t) ||
+        header->node_size != sizeof(snapshot_node_t))
+        return -1;
+    if (!snapshot_fits(self, header->stops_offset, header->num_stops,
+                       sizeof(snapshot_stop_t)) ||
+        !snapshot_fits(self, header->lines_offset, header->num_lines,
+                       sizeof(snapshot_line_t)) ||
+        !snapshot_fits(self, header->nodes_offset, header->num_nodes,
+                       sizeof(snapshot_node_t)) ||
+        header->names_offset > self->size ||
+        header->names_size > self->size - header->names_offset)
+        return -1;
+
+    self->stops = (const snapshot_stop_t*)((char*)self->data +
+                                           header->stops_offset);
+    self->lines = (const snapshot_line_t*)((char*)self->data +
+                                           header->lines_offset);
+    self->nodes = (const snapshot_node_t*)((char*)self->data +
+                                           header->nodes_offset);
+    self->names = (char*)self->data + header->names_offset;
+
+    /* every name ends inside the names */
+    if (header->names_size && self->names[header->names_size - 1])
+        return -1;
+    for (i = 0; i < header->num_stops; i++)
+        if (self->stops[i].name >= header->names_size)
+            return -1;
+    for (i = 0; i < header->num_lines; i++)
+        if (self->lines[i].name >= header->names_size ||
+            self->lines[i].first_node > header->num_nodes ||
+            self->lines[i].num_stops >
+                header->num_nodes - self->lines[i].first_node)
+            return -1;
+    for (i = 0; i < header->num_nodes; i++)
+        if (self->nodes[i].stop >= header->num_stops)
+            return -1;
+    return 0;
+}
+
+/*
+ * maps the snapshot in the given file to memory, and checks it.
+ * returns 0 if ok, -1 if it couldn't be read or isn't a valid snapshot.
+ */
+int snapshot_open(snapshot_t* self, const char* path) {
+    struct stat info;
+    int fd;
+
+    self->data = NULL;
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    if (fstat(fd, &info) || info.st_size < (off_t)sizeof(snapshot_header_t)) {
+        close(fd);
+        return -1;
+    }
+    self->size = (size_t)info.st_size;
+    self->data = mmap(NULL, self->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (self->data == MAP_FAILED) {
+        self->data = NULL;
+        return -1;
+    }
+    self->header = self->data;
+    if (snapshot_check(self)) {
+        snapshot_close(self);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * unmaps the snapshot.
+ */
+void snapshot_close(snapshot_t* self) {
+    if (self->data)
+        munmap(self->data, self->size);
+    self->data = NULL;
+}
@@ -0,0 +1,104 @@
+#ifndef SNAPSHOT_HEADER
+#define SNAPSHOT_HEADER
+#include <limits.h>
+#include <stdio.h>
+
+/*
+ * binary image of a network.
+ * a header, then the stops, the lines, the nodes of every line (one after the
+ * other) and the names, each at the offset the header gives. there are no
+ * pointers: stops are referenced by index, names by offset in the names, so
+ * the file can be mapped and read in place.
+ * numbers are stored as in memory, so a snapshot is only read back on the same
+ * kind of machine (the header says which).
+ */
+#define SNAPSHOT_MAGIC "IAEDNET"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_BYTE_ORDER 0x01020304UL
+
+#if UINT_MAX == 0xffffffffUL
+typedef unsigned int snapshot_u32;
+#else
+typedef unsigned long snapshot_u32;
+#endif
+
+typedef struct {
+    char magic[8];
+    snapshot_u32 version;
+    snapshot_u32 byte_order;
+    /* sizes of the records, which depend on the compiler */
+    snapshot_u32 stop_size;
+    snapshot_u32 line_size;
+    snapshot_u32 node_size;
+    snapshot_u32 num_stops;
+    snapshot_u32 num_lines;
+    snapshot_u32 num_nodes;
+    snapshot_u32 names_size;
+    snapshot_u32 stops_offset;
+    snapshot_u32 lines_offset;
+    snapshot_u32 nodes_offset;
+    snapshot_u32 names_offset;
+} snapshot_header_t;
+
+/* in the order they were added */
+typedef struct {
+    double latitude;
+    double longitude;
+    snapshot_u32 name;
+} snapshot_stop_t;
+
+/* in the order they were added; the totals are kept as they were summed */
+typedef struct {
+    double total_cost;
+    double total_duration;
+    snapshot_u32 name;
+    snapshot_u32 first_node;
+    snapshot_u32 num_stops;
+} snapshot_line_t;
+
+/* from origin to destination; the cost and duration of the link arriving */
+typedef struct {
+    double cost;
+    double duration;
+    snapshot_u32 stop;
+} snapshot_node_t;
+
+/*
+ * a snapshot being written, a section at a time (stops, lines, nodes and then
+ * names), each in order.
+ */
+typedef struct {
+    FILE* file;
+    snapshot_header_t header;
+    unsigned long position; /* bytes written so far */
+    snapshot_u32 names_size; /* given to names so far */
+} snapshot_writer_t;
+
+/* a snapshot mapped to memory, already checked */
+typedef struct {
+    void* data;
+    size_t size;
+    const snapshot_header_t* header;
+    const snapshot_stop_t* stops;
+    const snapshot_line_t* lines;
+    const snapshot_node_t* nodes;
+    const char* names;
+} snapshot_t;
+
+int snapshot_begin(snapshot_writer_t* self, const char* path,
+                   unsigned long num_stops, unsigned long num_lines,
+                   unsigned long num_nodes, unsigned long names_size);
+int snapshot_stop(snapshot_writer_t* self, double latitude, double longitude,
+                  const char* name);
+int snapshot_line(snapshot_writer_t* self, double total_cost,
+                  double total_duration, const char* name,
+                  unsigned long first_node, unsigned long num_stops);
+int snapshot_node(snapshot_writer_t* self, double cost, double duration,
+                  unsigned long stop);
+int snapshot_name(snapshot_writer_t* self, const char* name);
+int snapshot_end(snapshot_writer_t* self);
+
+int snapshot_open(snapshot_t* self, const char* path);
+void snapshot_close(snapshot_t* self);
+
+#endif /* !SNAPSHOT_HEADER */
@@ -0,0 +1,494 @@
+#include "spatial.h"
+#include "stats.h"
+
+/* no node is linked there */
+#define SPATIAL_NONE ((unsigned int)-1)
+/*
+ * a subtree is rebuilt when one of its halves has more than this share of its
+ * nodes, which keeps every node within log(nodes) / log(1 / share) levels
+ */
+#define SPATIAL_BALANCE 0.75
+
+void spatial_init(spatial_t* self) {
+    memset(self, 0, sizeof(spatial_t));
+    self->root = self->free_nodes = SPATIAL_NONE;
+}
+
+void spatial_destroy(spatial_t* self) {
+    free(self->nodes);
+    free(self->node_of);
+    free(self->pending);
+    free(self->scratch);
+    free(self->found);
+    free(self->heap);
+    spatial_init(self);
+}
+
+/*
+ * forgets every stop, keeping the arrays for the next ones.
+ */
+void spatial_clear(spatial_t* self) {
+    self->num_nodes = self->num_pending = 0;
+    self->num_live = self->num_dead = self->num_found = 0;
+    self->root = self->free_nodes = SPATIAL_NONE;
+}
+
+/*
+ * reallocs the array, keeping it as it was if there is no memory for it (and
+ * saying so in failed).
+ */
+__always_inline void* spatial_grow(void* array, size_t size, int* failed) {
+    void* new = realloc(array, size);
+    if (!new) {
+        *failed = 1;
+        return array;
+    }
+    return new;
+}
+
+/*
+ * makes room for the given number of nodes (and as many pending ones, or
+ * found stops).
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int spatial_reserve_nodes(spatial_t* self, unsigned int size) {
+    unsigned int capacity = (self->capacity) ? self->capacity : 64;
+    int failed = 0;
+
+    if (size <= self->capacity)
+        return 0;
+    while (capacity < size)
+        capacity *= 2;
+
+    self->nodes = spatial_grow(self->nodes, sizeof(spatial_node_t) * capacity,
+                               &failed);
+    self->pending = spatial_grow(self->pending,
+                                 sizeof(unsigned int) * capacity, &failed);
+    self->scratch = spatial_grow(self->scratch,
+                                 sizeof(unsigned int) * capacity, &failed);
+    self->found =
+        spatial_grow(self->found, sizeof(unsigned int) * capacity, &failed);
+    if (failed)
+        return -1;
+    self->capacity = capacity;
+    return 0;
+}
+
+/*
+ * makes room for stop ids up to the given number.
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int spatial_reserve_stops(spatial_t* self, unsigned int size) {
+    unsigned int capacity =
+        (self->node_of_capacity) ? self->node_of_capacity : 64;
+    unsigned int* node_of;
+
+    if (size <= self->node_of_capacity)
+        return 0;
+    while (capacity < size)
+        capacity *= 2;
+    if (!(node_of = realloc(self->node_of, sizeof(unsigned int) * capacity)))
+        return -1;
+    self->node_of = node_of;
+    self->node_of_capacity = capacity;
+    return 0;
+}
+
+/*
+ * adds the stop with the given id and location.
+ * it goes into the tree with the next query.
+ * returns 0 if ok, -1 if there wasn't memory for it.
+ */
+int spatial_add(spatial_t* self, unsigned int stop, double latitude,
+                double longitude) {
+    unsigned int node;
+    spatial_node_t* new;
+
+    if (spatial_reserve_stops(self, stop + 1))
+        return -1;
+    if (self->free_nodes != SPATIAL_NONE) {
+        node = self->free_nodes;
+        self->free_nodes = self->nodes[node].left;
+    } else if (spatial_reserve_nodes(self, self->num_nodes + 1))
+        return -1;
+    else
+        node = self->num_nodes++;
+
+    new = self->nodes + node;
+    new->latitude = latitude;
+    new->longitude = longitude;
+    new->stop = stop;
+    new->left = new->right = SPATIAL_NONE;
+    new->size = 1;
+    self->node_of[stop] = node;
+    self->pending[self->num_pending++] = node;
+    self->num_live++;
+    return 0;
+}
+
+/*
+ * the coordinate of the node the given level splits by.
+ */
+__always_inline double spatial_key(const spatial_node_t* node, int axis) {
+    return (axis) ? node->longitude : node->latitude;
+}
+
+/*
+ * puts the node with the k-th smallest coordinate (of the given axis) at
+ * items[k], the ones before it not after it and the ones after it not before
+ * it (a quickselect, with the median of three as the pivot).
+ */
+void spatial_select(spatial_t* self, unsigned int* items, unsigned int count,
+                    unsigned int k, int axis) {
+    long low = 0, high = (long)count - 1, i, j;
+    double pivot, a, b, c;
+    unsigned int swap;
+
+    while (low < high) {
+        a = spatial_key(self->nodes + items[low], axis);
+        b = spatial_key(self->nodes + items[low + (high - low) / 2], axis);
+        c = spatial_key(self->nodes + items[high], axis);
+        pivot = (a < b) ? ((b < c) ? b : (a < c) ? c : a)
+                        : ((a < c) ? a : (b < c) ? c : b);
+        i = low;
+        j = high;
+        while (i <= j) {
+            while (spatial_key(self->nodes + items[i], axis) < pivot)
+                i++;
+            while (spatial_key(self->nodes + items[j], axis) > pivot)
+                j--;
+            if (i <= j) {
+                swap = items[i];
+                items[i++] = items[j];
+                items[j--] = swap;
+            }
+        }
+        if ((long)k <= j)
+            high = j;
+        else if ((long)k >= i)
+            low = i;
+        else
+            break;
+    }
+}
+
+/*
+ * links the given nodes into a balanced subtree, whose root splits by the
+ * given axis.
+ * returns its root.
+ */
+unsigned int spatial_build(spatial_t* self, unsigned int* items,
+                           unsigned int count, int axis) {
+    unsigned int middle = count / 2, node;
+    spatial_node_t* root;
+
+    if (!count)
+        return SPATIAL_NONE;
+    spatial_select(self, items, count, middle, axis);
+    node = items[middle];
+    root = self->nodes + node;
+    root->left = spatial_build(self, items, middle, !axis);
+    root->right =
+        spatial_build(self, items + middle + 1, count - middle - 1, !axis);
+    root->size = count;
+    return node;
+}
+
+/*
+ * rebuilds the whole tree with every stop (the pending ones too), leaving the
+ * removed ones out. the nodes are packed at the start of the array.
+ */
+void spatial_rebuild(spatial_t* self) {
+    unsigned int i, size = 0;
+
+    for (i = 0; i < self->num_nodes; i++)
+        if (self->nodes[i].stop != NO_STOP) {
+            self->nodes[size] = self->nodes[i];
+            self->node_of[self->nodes[size].stop] = size;
+            self->scratch[size] = size;
+            size++;
+        }
+    self->num_nodes = size;
+    self->free_nodes = SPATIAL_NONE;
+    self->num_pending = self->num_dead = 0;
+    self->root = spatial_build(self, self->scratch, size, 0);
+}
+
+/*
+ * removes the stop with the given id (which may be given to another stop
+ * right after).
+ */
+void spatial_remove(spatial_t* self, unsigned int stop) {
+    self->nodes[self->node_of[stop]].stop = NO_STOP;
+    self->num_live--;
+    self->num_dead++;
+    if (self->num_dead > self->num_live)
+        spatial_rebuild(self);
+}
+
+/*
+ * gathers the nodes of the stops in the subtree in the scratch array, freeing
+ * the removed ones.
+ */
+void spatial_collect(spatial_t* self, unsigned int node, unsigned int* count) {
+    spatial_node_t* current;
+
+    if (node == SPATIAL_NONE)
+        return;
+    current = self->nodes + node;
+    spatial_collect(self, current->left, count);
+    spatial_collect(self, current->right, count);
+    if (current->stop != NO_STOP)
+        self->scratch[(*count)++] = node;
+    else {
+        current->left = self->free_nodes;
+        self->free_nodes = node;
+        self->num_dead--;
+    }
+}
+
+/*
+ * puts the node into the tree, as a leaf.
+ * if it ends up deeper than the size of the tree allows, the subtree of the
+ * lowest of its ancestors that is out of balance is rebuilt.
+ */
+void spatial_link(spatial_t* self, unsigned int node) {
+    unsigned int path[SPATIAL_MAX_DEPTH];
+    unsigned int *link = &self->root, depth = 0, size, before, i;
+    const spatial_node_t* new = self->nodes + node;
+    spatial_node_t* parent;
+    double bound = 1;
+
+    while (*link != SPATIAL_NONE) {
+        parent = self->nodes + (path[depth] = *link);
+        parent->size++;
+        link = (spatial_key(new, depth & 1) < spatial_key(parent, depth & 1))
+                   ? &parent->left
+                   : &parent->right;
+        depth++;
+    }
+    *link = node;
+
+    for (i = 0; i < depth; i++)
+        bound /= SPATIAL_BALANCE;
+    if (bound <= self->nodes[self->root].size)
+        return;
+    for (size = 1, i = depth; i-- > 0; size = self->nodes[path[i]].size)
+        if (size > SPATIAL_BALANCE * self->nodes[path[i]].size)
+            break;
+    if (i == (unsigned int)-1)
+        return;
+
+    if (!i)
+        link = &self->root;
+    else {
+        parent = self->nodes + path[i - 1];
+        link = (parent->left == path[i]) ? &parent->left : &parent->right;
+    }
+    before = self->nodes[path[i]].size;
+    size = 0;
+    spatial_collect(self, path[i], &size);
+    *link = spatial_build(self, self->scratch, size, i & 1);
+    while (i-- > 0)
+        self->nodes[path[i]].size -= before - size;
+}
+
+/*
+ * puts the stops added since the last query into the tree (rebuilding it
+ * whole, if they are more than it has).
+ */
+void spatial_flush(spatial_t* self) {
+    unsigned int i, node;
+
+    if (!self->num_pending)
+        return;
+    if (self->root == SPATIAL_NONE ||
+        self->num_pending > self->nodes[self->root].size) {
+        spatial_rebuild(self);
+        return;
+    }
+    for (i = 0; i < self->num_pending; i++) {
+        node = self->pending[i];
+        if (self->nodes[node].stop != NO_STOP)
+            spatial_link(self, node);
+        else {
+            self->nodes[node].left = self->free_nodes;
+            self->free_nodes = node;
+            self->num_dead--;
+        }
+    }
+    self->num_pending = 0;
+}
+
+/*
+ * compares stops found by a nearest query: the farther one (or the one added
+ * later, if they are just as far) goes first in the heap.
+ */
+__always_inline int spatial_farther(const spatial_near_t* a,
+                                    const spatial_near_t* b) {
+    return a->distance > b->distance ||
+           (a->distance == b->distance && a->order > b->order);
+}
+
+/*
+ * takes the farthest stop out of the heap.
+ */
+void spatial_heap_pop(spatial_t* self) {
+    spatial_near_t* heap = self->heap;
+    spatial_near_t last = heap[--self->num_found];
+    unsigned int i = 0, child;
+
+    while ((child = 2 * i + 1) < self->num_found) {
+        if (child + 1 < self->num_found &&
+            spatial_farther(heap + child + 1, heap + child))
+            child++;
+        if (!spatial_farther(heap + child, &last))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = last;
+}
+
+/*
+ * keeps the stop if it is among the count nearest ones found so far.
+ */
+void spatial_offer(spatial_t* self, const spatial_near_t* near,
+                   unsigned int count) {
+    spatial_near_t* heap = self->heap;
+    unsigned int i, parent;
+
+    if (self->num_found == count) {
+        if (!spatial_farther(heap, near))
+            return;
+        spatial_heap_pop(self);
+    }
+    for (i = self->num_found++; i; i = parent) {
+        parent = (i - 1) / 2;
+        if (!spatial_farther(near, heap + parent))
+            break;
+        heap[i] = heap[parent];
+    }
+    heap[i] = *near;
+}
+
+/*
+ * looks for the nearest stops in the subtree, whose root splits by the given
+ * axis: first on the side of the point, then on the other one, if it can
+ * still be as near as the farthest one kept.
+ */
+void spatial_nearest_from(spatial_t* self, const stop_table_t* stops,
+                          unsigned int node, int axis, double latitude,
+                          double longitude, unsigned int count) {
+    const spatial_node_t* current;
+    spatial_near_t near;
+    double difference;
+
+    if (node == SPATIAL_NONE)
+        return;
+    current = self->nodes + node;
+    STATS_ADD(STATS_SPATIAL_VISITS, 1);
+    if (current->stop != NO_STOP) {
+        near.distance = (latitude - current->latitude) *
+                            (latitude - current->latitude) +
+                        (longitude - current->longitude) *
+                            (longitude - current->longitude);
+        near.order = stops->records[current->stop].order;
+        near.stop = current->stop;
+        spatial_offer(self, &near, count);
+    }
+
+    difference = (axis) ? longitude - current->longitude
+                        : latitude - current->latitude;
+    spatial_nearest_from(self, stops,
+                         (difference < 0) ? current->left : current->right,
+                         !axis, latitude, longitude, count);
+    if (self->num_found < count ||
+        difference * difference <= self->heap->distance)
+        spatial_nearest_from(self, stops,
+                             (difference < 0) ? current->right : current->left,
+                             !axis, latitude, longitude, count);
+}
+
+/*
+ * finds the count stops nearest to the given point (by the distance between
+ * their coordinates), nearest first, and the ones added first among those
+ * just as near.
+ * returns 0 if ok, -1 if there wasn't memory for the search.
+ */
+int spatial_nearest(spatial_t* self, const stop_table_t* stops,
+                    double latitude, double longitude, unsigned int count) {
+    spatial_near_t* heap;
+    unsigned int i;
+
+    spatial_flush(self);
+    self->num_found = 0;
+    if (count > self->num_live)
+        count = self->num_live;
+    if (!count)
+        return 0;
+    if (count > self->heap_capacity) {
+        if (!(heap = realloc(self->heap, sizeof(spatial_near_t) * count)))
+            return -1;
+        self->heap = heap;
+        self->heap_capacity = count;
+    }
+
+    spatial_nearest_from(self, stops, self->root, 0, latitude, longitude,
+                         count);
+    for (i = self->num_found; i-- > 0;) {
+        self->found[i] = self->heap->stop;
+        spatial_heap_pop(self);
+    }
+    self->num_found = count;
+    return 0;
+}
+
+/*
+ * gathers the stops of the subtree inside the box, skipping the halves that
+ * are out of it.
+ */
+void spatial_box_from(spatial_t* self, unsigned int node, int axis,
+                      double south, double west, double north, double east) {
+    const spatial_node_t* current;
+    double key;
+
+    if (node == SPATIAL_NONE)
+        return;
+    current = self->nodes + node;
+    STATS_ADD(STATS_SPATIAL_VISITS, 1);
+    if (current->stop != NO_STOP && current->latitude >= south &&
+        current->latitude <= north && current->longitude >= west &&
+        current->longitude <= east)
+        self->found[self->num_found++] = current->stop;
+
+    key = spatial_key(current, axis);
+    if (((axis) ? west : south) <= key)
+        spatial_box_from(self, current->left, !axis, south, west, north, east);
+    if (((axis) ? east : north) >= key)
+        spatial_box_from(self, current->right, !axis, south, west, north,
+                         east);
+}
+
+/*
+ * finds the stops inside the box with the given corners (borders included),
+ * in no particular order.
+ */
+void spatial_box(spatial_t* self, double south, double west, double north,
+                 double east) {
+    double swap;
+
+    if (south > north) {
+        swap = south;
+        south = north;
+        north = swap;
+    }
+    if (west > east) {
+        swap = west;
+        west = east;
+        east = swap;
+    }
+    spatial_flush(self);
+    self->num_found = 0;
+    spatial_box_from(self, self->root, 0, south, west, north, east);
+}
@@ -0,0 +1,67 @@
+#ifndef SPATIAL_HEADER
+#define SPATIAL_HEADER
+
+#include "main.h"
+#include "stop-table.h"
+
+/* the deepest a node can be (the tree is kept balanced well within it) */
+#define SPATIAL_MAX_DEPTH 128
+
+/*
+ * a stop in the tree, with a copy of its location (its id may be given to
+ * another stop before the tree is rebuilt without it).
+ */
+typedef struct {
+    double latitude;
+    double longitude;
+    unsigned int stop; /* NO_STOP once the stop is removed */
+    unsigned int left;
+    unsigned int right;
+    unsigned int size; /* nodes in the subtree, removed ones too */
+} spatial_node_t;
+
+/* a stop found by a nearest query, with its distance (squared) */
+typedef struct {
+    double distance;
+    unsigned long order;
+    unsigned int stop;
+} spatial_near_t;
+
+/*
+ * 2-d tree over the locations of the stops, splitting by latitude and then
+ * longitude, level after level.
+ * new stops wait in a list until the next query, and removed ones are only
+ * marked as such: the parts of the tree that get too deep (or the whole of
+ * it, when there are more removed stops than stops) are rebuilt balanced.
+ */
+typedef struct {
+    spatial_node_t* nodes;
+    unsigned int num_nodes;
+    unsigned int capacity;
+    unsigned int root;
+    unsigned int free_nodes; /* to reuse, linked by their left */
+    unsigned int* node_of;   /* by stop id */
+    unsigned int node_of_capacity;
+    unsigned int* pending; /* nodes not in the tree yet */
+    unsigned int num_pending;
+    unsigned int num_live;
+    unsigned int num_dead;
+    unsigned int* scratch; /* nodes of a subtree being rebuilt */
+    unsigned int* found;   /* stops found by the last query */
+    unsigned int num_found;
+    spatial_near_t* heap; /* farthest of the nearest on top */
+    unsigned int heap_capacity;
+} spatial_t;
+
+void spatial_init(spatial_t* self);
+void spatial_destroy(spatial_t* self);
+void spatial_clear(spatial_t* self);
+int spatial_add(spatial_t* self, unsigned int stop, double latitude,
+                double longitude);
+void spatial_remove(spatial_t* self, unsigned int stop);
+int spatial_nearest(spatial_t* self, const stop_table_t* stops,
+                    double latitude, double longitude, unsigned int count);
+void spatial_box(spatial_t* self, double south, double west, double north,
+                 double east);
+
+#endif /* !SPATIAL_HEADER */
@@ -0,0 +1,102 @@
+#define _POSIX_C_SOURCE 200112L
+#include "stats.h"
+
+/* keeps the translation unit from being empty without -DSTATS */
+typedef int stats_unused_t;
+
+#ifdef STATS
+#include <time.h>
+
+/* the command letters are plain ascii */
+#define STATS_COMMANDS 128
+
+typedef struct {
+    unsigned long count;
+    double total; /* in seconds */
+    unsigned long buckets[STATS_BUCKETS];
+} stats_histogram_t;
+
+static const char* const counter_names[STATS_NUM_COUNTERS] = {
+    "hash lookups", "hash probes", "stop unlinks", "unlink node visits",
+    "k-d tree node visits", "route node visits"};
+
+stats_histogram_t stats_histograms[STATS_COMMANDS];
+unsigned long stats_counters[STATS_NUM_COUNTERS];
+
+/*
+ * monotonic time, in seconds.
+ */
+double stats_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+/*
+ * adds a command, which took the given time, to its histogram.
+ * the bucket is the number of bits of the time in nanoseconds.
+ */
+void stats_command(char command, double seconds) {
+    stats_histogram_t* histogram = stats_histograms + (command & 0x7f);
+    double nanoseconds = seconds * 1e9;
+    unsigned long whole;
+    int bucket = 0;
+
+    whole = (nanoseconds < 1e12) ? (unsigned long)nanoseconds : 1000000000000UL;
+    while (whole && bucket < STATS_BUCKETS - 1) {
+        whole >>= 1;
+        bucket++;
+    }
+    __sync_fetch_and_add(&histogram->buckets[bucket], 1);
+    __sync_fetch_and_add(&histogram->count, 1);
+    histogram->total += seconds;
+}
+
+/*
+ * counters can be bumped from anywhere, without taking a lock.
+ */
+void stats_add(stats_counter_t counter, unsigned long amount) {
+    __sync_fetch_and_add(&stats_counters[counter], amount);
+}
+
+/*
+ * s command (and at q, to stderr).
+ * prints how many of each command there were, how long they took, and the
+ * distribution of those times; then the counters.
+ */
+void stats_print(output_t* out) {
+    const stats_histogram_t* histogram;
+    int command, bucket;
+    double bound;
+
+    for (command = 0; command < STATS_COMMANDS; command++) {
+        histogram = stats_histograms + command;
+        if (!histogram->count)
+            continue;
+        output_char(out, (char)command);
+        output_string(out, ": ");
+        output_int(out, (long)histogram->count);
+        output_string(out, " in ");
+        output_fixed(out, histogram->total, 0, 6);
+        output_string(out, " s\n");
+        /* each bucket has the times below its bound, in ns */
+        for (bucket = 0, bound = 1; bucket < STATS_BUCKETS;
+             bucket++, bound *= 2) {
+            if (!histogram->buckets[bucket])
+                continue;
+            output_string(out, "    < ");
+            output_fixed(out, bound, 14, 0);
+            output_string(out, " ns: ");
+            output_int(out, (long)histogram->buckets[bucket]);
+            output_char(out, '\n');
+        }
+    }
+    for (command = 0; command < STATS_NUM_COUNTERS; command++) {
+        output_string(out, counter_names[command]);
+        output_string(out, ": ");
+        output_int(out, (long)stats_counters[command]);
+        output_char(out, '\n');
+    }
+}
+
+#endif /* STATS */
@@ -0,0 +1,34 @@
+#ifndef STATS_HEADER
+#define STATS_HEADER
+
+/*
+ * instrumentation of the commands, only built with -DSTATS.
+ * without it, every STATS_ macro is empty and there is no stats command.
+ */
+#ifdef STATS
+#include "output.h"
+
+/* one bucket for each power of two of nanoseconds */
+#define STATS_BUCKETS 40
+
+typedef enum {
+    STATS_LOOKUPS,        /* hash table lookups */
+    STATS_PROBES,         /* groups of slots probed by them */
+    STATS_UNLINKS,        /* stops taken out of their lines */
+    STATS_NODE_VISITS,    /* nodes walked while doing it */
+    STATS_SPATIAL_VISITS, /* nodes of the k-d tree walked by queries */
+    STATS_ROUTE_VISITS,   /* stops settled by route searches */
+    STATS_NUM_COUNTERS
+} stats_counter_t;
+
+double stats_now(void);
+void stats_command(char command, double seconds);
+void stats_add(stats_counter_t counter, unsigned long amount);
+void stats_print(output_t* out);
+
+#define STATS_ADD(counter, amount) stats_add(counter, amount)
+#else
+#define STATS_ADD(counter, amount) ((void)0)
+#endif /* STATS */
+
+#endif /* !STATS_HEADER */
@@ -0,0 +1,174 @@
+#include "stop-table.h"
+
+/*
+ * initializes an empty table.
+ * no memory is reserved until the first stop.
+ */
+void stop_table_init(stop_table_t* self) {
+    memset(self, 0, sizeof(stop_table_t));
+}
+
+/*
+ * frees the arrays of the table (what the records point to comes from the
+ * pools, and isn't freed here).
+ */
+void stop_table_destroy(stop_table_t* self) {
+    free(self->names);
+    free(self->latitudes);
+    free(self->longitudes);
+    free(self->num_lines);
+    free(self->records);
+    free(self->free_ids);
+    free(self->listing);
+    stop_table_init(self);
+}
+
+/*
+ * forgets every stop, keeping the arrays for the next ones.
+ */
+void stop_table_clear(stop_table_t* self) {
+    self->size = self->num_free_ids = 0;
+    self->listing_size = self->num_stops = 0;
+}
+
+/*
+ * reallocs the array, keeping it as it was if there is no memory for it (and
+ * saying so in failed).
+ */
+__always_inline void* stop_table_grow(void* array, size_t size, int* failed) {
+    void* new = realloc(array, size);
+    if (!new) {
+        *failed = 1;
+        return array;
+    }
+    return new;
+}
+
+/*
+ * makes room for ids up to the given number.
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int stop_table_reserve_ids(stop_table_t* self, unsigned int size) {
+    unsigned int capacity =
+        (self->capacity) ? self->capacity : STOP_TABLE_MIN_CAPACITY;
+    unsigned int i;
+    int failed = 0;
+
+    if (size <= self->capacity)
+        return 0;
+    while (capacity < size)
+        capacity *= 2;
+
+    self->names =
+        stop_table_grow(self->names, sizeof(char*) * capacity, &failed);
+    self->latitudes =
+        stop_table_grow(self->latitudes, sizeof(double) * capacity, &failed);
+    self->longitudes =
+        stop_table_grow(self->longitudes, sizeof(double) * capacity, &failed);
+    self->num_lines =
+        stop_table_grow(self->num_lines, sizeof(int) * capacity, &failed);
+    self->free_ids = stop_table_grow(self->free_ids,
+                                     sizeof(unsigned int) * capacity, &failed);
+    self->records =
+        stop_table_grow(self->records, sizeof(stop_t) * capacity, &failed);
+    /* small line sets point into themselves, and the records may have moved */
+    for (i = 0; i < self->size; i++)
+        line_set_relocate(&self->records[i].lines);
+    if (failed)
+        return -1;
+    self->capacity = capacity;
+    return 0;
+}
+
+/*
+ * makes room in the listing for the given number of ids.
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int stop_table_reserve_listing(stop_table_t* self, unsigned int size) {
+    unsigned int capacity = (self->listing_capacity) ? self->listing_capacity
+                                                     : STOP_TABLE_MIN_CAPACITY;
+    unsigned int* listing;
+
+    if (size <= self->listing_capacity)
+        return 0;
+    while (capacity < size)
+        capacity *= 2;
+    if (!(listing = realloc(self->listing, sizeof(unsigned int) * capacity)))
+        return -1;
+    self->listing = listing;
+    self->listing_capacity = capacity;
+    return 0;
+}
+
+/*
+ * makes room for the given number of new stops.
+ * returns 0 if ok, -1 if there wasn't memory for them.
+ */
+int stop_table_reserve(stop_table_t* self, unsigned int count) {
+    if (stop_table_reserve_ids(self, self->size + count) ||
+        stop_table_reserve_listing(self, self->listing_size + count))
+        return -1;
+    return 0;
+}
+
+/*
+ * adds a stop with the given name (which the table keeps) and location, at
+ * the end of the listing.
+ * returns its id, or NO_STOP if there wasn't memory for it.
+ */
+unsigned int stop_table_add(stop_table_t* self, char* name, double latitude,
+                            double longitude) {
+    unsigned int id;
+    stop_t* record;
+
+    if (stop_table_reserve_listing(self, self->listing_size + 1))
+        return NO_STOP;
+    if (self->num_free_ids)
+        id = self->free_ids[--self->num_free_ids];
+    else if (stop_table_reserve_ids(self, self->size + 1))
+        return NO_STOP;
+    else
+        id = self->size++;
+
+    self->names[id] = name;
+    self->latitudes[id] = latitude;
+    self->longitudes[id] = longitude;
+    self->num_lines[id] = 0;
+    record = self->records + id;
+    line_set_init(&record->lines);
+    record->sorted_lines = NULL;
+    record->sorted_lines_capacity = 0;
+    record->order = 0;
+    record->unsorted = 0;
+    record->position = self->listing_size;
+    self->listing[self->listing_size++] = id;
+    self->num_stops++;
+    return id;
+}
+
+/*
+ * takes the holes out of the listing.
+ */
+void stop_table_pack(stop_table_t* self) {
+    unsigned int i, size = 0, id;
+
+    for (i = 0; i < self->listing_size; i++)
+        if ((id = self->listing[i]) != NO_STOP) {
+            self->records[id].position = size;
+            self->listing[size++] = id;
+        }
+    self->listing_size = size;
+}
+
+/*
+ * removes the stop with the given id, which will be given to another one.
+ * what its record points to must already be freed.
+ */
+void stop_table_remove(stop_table_t* self, unsigned int id) {
+    self->listing[self->records[id].position] = NO_STOP;
+    self->names[id] = NULL;
+    self->free_ids[self->num_free_ids++] = id;
+    self->num_stops--;
+    if (self->listing_size - self->num_stops > self->num_stops)
+        stop_table_pack(self);
+}
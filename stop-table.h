@@ -0,0 +1,41 @@
+#ifndef STOP_TABLE_HEADER
+#define STOP_TABLE_HEADER
+
+#include "main.h"
+
+/* ids (and the listing) start with room for this many stops */
+#define STOP_TABLE_MIN_CAPACITY 64
+
+/*
+ * the stops, by dense id (the ids of removed stops are given to new ones).
+ * what the listings read is kept in parallel arrays, the rest in a record per
+ * stop.
+ * the ids are also listed in the order the stops were added, with holes
+ * (NO_STOP) where removed stops were, until there are more holes than stops.
+ */
+typedef struct {
+    char** names;
+    double* latitudes;
+    double* longitudes;
+    int* num_lines;
+    stop_t* records;
+    unsigned int size; /* ids given so far */
+    unsigned int capacity;
+    unsigned int* free_ids;
+    unsigned int num_free_ids;
+    unsigned int* listing;
+    unsigned int listing_size;
+    unsigned int listing_capacity;
+    unsigned int num_stops;
+} stop_table_t;
+
+void stop_table_init(stop_table_t* self);
+void stop_table_destroy(stop_table_t* self);
+void stop_table_clear(stop_table_t* self);
+int stop_table_reserve(stop_table_t* self, unsigned int count);
+unsigned int stop_table_add(stop_table_t* self, char* name, double latitude,
+                            double longitude);
+void stop_table_remove(stop_table_t* self, unsigned int id);
+void stop_table_pack(stop_table_t* self);
+
+#endif /* !STOP_TABLE_HEADER */